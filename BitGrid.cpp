@@ -0,0 +1,141 @@
+#include "BitGrid.h"
+#include "utils.h"
+
+#include <algorithm>
+
+BitGrid::BitGrid(int sizeX, int sizeY, int sizeZ)
+    : sizeX{sizeX}, sizeY{sizeY}, sizeZ{sizeZ}, wordsPerRow{(sizeZ + 2 + 63) / 64},
+    wordsPerPlane{(sizeY + 2) * wordsPerRow}, planes(sizeX + 2, wordsPerPlane) {}
+
+bool BitGrid::isInRange(Pos p) const {
+    // negative coordinates wrap around to large unsigned values
+    return (unsigned)p.x < (unsigned)sizeX
+        && (unsigned)p.y < (unsigned)sizeY
+        && (unsigned)p.z < (unsigned)sizeZ;
+}
+
+bool BitGrid::test(Pos p) const {
+    return isInRange(p) && get(p);
+}
+
+int BitGrid::count() const {
+    int count = 0;
+    for (size_t c = 0; c < planes.numChunks(); ++c) {
+        const uint64_t *words = planes.chunk(c);
+        for (int i = 0; i < wordsPerPlane; ++i) {
+            count += popcount(words[i]);
+        }
+    }
+    return count;
+}
+
+bool BitGrid::boundingBox(Pos &min, Pos &max) const {
+    min = Pos{sizeX, sizeY, sizeZ};
+    max = Pos{-1, -1, -1};
+    for (int x = 0; x < sizeX; ++x) {
+        for (int y = 0; y < sizeY; ++y) {
+            const uint64_t *words = row(x, y);
+            int first = 0, last = wordsPerRow - 1;
+            while (first < wordsPerRow && words[first] == 0) ++first;
+            if (first == wordsPerRow) continue;
+            while (words[last] == 0) --last;
+            // bit positions in the padded row are one more than z
+            int lo = first * 64 + countTrailingZeros(words[first]) - 1;
+            int hi = last * 64 + 63 - countLeadingZeros(words[last]) - 1;
+            min = Pos{std::min(min.x, x), std::min(min.y, y), std::min(min.z, lo)};
+            max = Pos{std::max(max.x, x), std::max(max.y, y), std::max(max.z, hi)};
+        }
+    }
+    return max.x >= 0;
+}
+
+BitGrid BitGrid::shifted(Direction dir, int steps) const {
+    BitGrid result{sizeX, sizeY, sizeZ};
+    if (dir == Direction::ZP || dir == Direction::ZN) {
+        int wordShift = steps >> 6;
+        int bitShift = steps & 63;
+        // bits past the last voxel of a row are border and must stay zero
+        uint64_t lastWordMask = (uint64_t{1} << (sizeZ + 1 - (wordsPerRow - 1) * 64)) - 1;
+        for (int x = 0; x < sizeX; ++x) {
+            for (int y = 0; y < sizeY; ++y) {
+                const uint64_t *words = row(x, y);
+                uint64_t *out = result.mutableRow(x, y);
+                auto source = [&](int i) {
+                    return i >= 0 && i < wordsPerRow ? words[i] : 0;
+                };
+                for (int i = 0; i < wordsPerRow; ++i) {
+                    if (dir == Direction::ZP) {
+                        out[i] = source(i - wordShift) << bitShift;
+                        if (bitShift != 0) out[i] |= source(i - wordShift - 1) >> (64 - bitShift);
+                    } else {
+                        out[i] = source(i + wordShift) >> bitShift;
+                        if (bitShift != 0) out[i] |= source(i + wordShift + 1) << (64 - bitShift);
+                    }
+                }
+                out[0] &= ~uint64_t{1};
+                out[wordsPerRow - 1] &= lastWordMask;
+            }
+        }
+        return result;
+    }
+    int dx = 0, dy = 0;
+    switch (dir) {
+        case Direction::XP: dx = steps; break;
+        case Direction::XN: dx = -steps; break;
+        case Direction::YP: dy = steps; break;
+        case Direction::YN: dy = -steps; break;
+        default: break;
+    }
+    for (int x = 0; x < sizeX; ++x) {
+        for (int y = 0; y < sizeY; ++y) {
+            int fromX = x - dx, fromY = y - dy;
+            if (fromX < 0 || fromX >= sizeX || fromY < 0 || fromY >= sizeY) continue;
+            std::copy_n(row(fromX, fromY), wordsPerRow, result.mutableRow(x, y));
+        }
+    }
+    return result;
+}
+
+BitGrid BitGrid::swept(Direction dir) const {
+    int length = sizeZ;
+    if (dir == Direction::XP || dir == Direction::XN) length = sizeX;
+    if (dir == Direction::YP || dir == Direction::YN) length = sizeY;
+    BitGrid result = shifted(dir, 1);
+    // result covers distances 1..reach, so adding a copy moved by reach
+    // covers 1..2 * reach
+    for (int reach = 1; reach < length - 1; reach *= 2) {
+        result |= result.shifted(dir, reach);
+    }
+    return result;
+}
+
+BitGrid &BitGrid::operator|=(const BitGrid &other) {
+    for (size_t c = 0; c < planes.numChunks(); ++c) {
+        const uint64_t *words = planes.chunk(c);
+        const uint64_t *otherWords = other.planes.chunk(c);
+        // shared planes are equal, and planes that wouldn't change are
+        // left shared
+        if (words == otherWords) continue;
+        bool adds = false;
+        for (int i = 0; i < wordsPerPlane && !adds; ++i) {
+            adds = (otherWords[i] & ~words[i]) != 0;
+        }
+        if (!adds) continue;
+        uint64_t *out = planes.mutableChunk(c);
+        for (int i = 0; i < wordsPerPlane; ++i) {
+            out[i] |= otherWords[i];
+        }
+    }
+    return *this;
+}
+
+bool BitGrid::intersects(const BitGrid &other) const {
+    for (size_t c = 0; c < planes.numChunks(); ++c) {
+        const uint64_t *words = planes.chunk(c);
+        const uint64_t *otherWords = other.planes.chunk(c);
+        for (int i = 0; i < wordsPerPlane; ++i) {
+            if (words[i] & otherWords[i]) return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,106 @@
+#ifndef HEADER_BIT_GRID
+#define HEADER_BIT_GRID
+
+#include "ChunkedArray.h"
+#include "Direction.h"
+#include "Pos.h"
+#include "utils.h"
+
+#include <cstdint>
+
+// One bit per voxel, packed 64 to a word along each z row. Rows start on a
+// word boundary so that a row can be scanned or shifted a word at a time.
+// Like Voxels, the grid has a one voxel border of zero bits, so get() can
+// be used on the direct neighbours of any voxel in range. Each x plane is a
+// chunk that copies of the grid share until one of them writes to it.
+class BitGrid {
+    int sizeX = 0;
+    int sizeY = 0;
+    int sizeZ = 0;
+    int wordsPerRow = 0;
+    int wordsPerPlane = 0;
+    ChunkedArray<uint64_t> planes;
+
+    const uint64_t *row(int x, int y) const {
+        return planes.chunk(x + 1) + (y + 1) * wordsPerRow;
+    }
+    uint64_t *mutableRow(int x, int y) {
+        return planes.mutableChunk(x + 1) + (y + 1) * wordsPerRow;
+    }
+
+public:
+    BitGrid() = default;
+    BitGrid(int sizeX, int sizeY, int sizeZ);
+
+    bool isInRange(Pos p) const;
+
+    // No bounds checks, p must be in range or next to a voxel in range
+    bool get(Pos p) const {
+        int z = p.z + 1;
+        return (row(p.x, p.y)[z >> 6] >> (z & 63)) & 1;
+    }
+
+    void set(Pos p, bool value) {
+        int z = p.z + 1;
+        uint64_t &word = mutableRow(p.x, p.y)[z >> 6];
+        uint64_t bit = uint64_t{1} << (z & 63);
+        if (value) {
+            word |= bit;
+        } else {
+            word &= ~bit;
+        }
+    }
+
+    // Returns false for positions outside the grid
+    bool test(Pos p) const;
+
+    int count() const;
+    // Smallest box holding every set bit, with min <= pos <= max on each
+    // axis, found a word at a time. Returns false if no bit is set.
+    bool boundingBox(Pos &min, Pos &max) const;
+
+    // Calls f(pos) for every set bit in x, y, z order
+    template <typename F>
+    void forEach(F f) const {
+        forEachInBox(Pos{0, 0, 0}, Pos{sizeX, sizeY, sizeZ}, f);
+    }
+
+    // Like forEach(), but only visits bits with min <= pos < max on every
+    // axis. Only the rows and words that overlap the box are read.
+    template <typename F>
+    void forEachInBox(Pos min, Pos max, F f) const {
+        if (min.z >= max.z) return;
+        // bit positions in the padded row
+        int lo = min.z + 1, hi = max.z + 1;
+        int firstWord = lo >> 6, lastWord = (hi - 1) >> 6;
+        int lastBits = ((hi - 1) & 63) + 1;
+        uint64_t firstMask = ~uint64_t{0} << (lo & 63);
+        uint64_t lastMask = lastBits == 64 ? ~uint64_t{0} : (uint64_t{1} << lastBits) - 1;
+        for (int x = min.x; x < max.x; ++x) {
+            for (int y = min.y; y < max.y; ++y) {
+                const uint64_t *words = row(x, y);
+                for (int i = firstWord; i <= lastWord; ++i) {
+                    uint64_t word = words[i];
+                    if (i == firstWord) word &= firstMask;
+                    if (i == lastWord) word &= lastMask;
+                    while (word != 0) {
+                        f(Pos{x, y, i * 64 + countTrailingZeros(word) - 1});
+                        word &= word - 1;
+                    }
+                }
+            }
+        }
+    }
+
+    // Returns the grid moved `steps` voxels in direction dir. Bits that
+    // would leave the grid are dropped.
+    BitGrid shifted(Direction dir, int steps) const;
+    // Every position the set bits pass through when moved any distance in
+    // direction dir, not counting where they start. Built from O(log size)
+    // shifts, each doubling the distance already covered.
+    BitGrid swept(Direction dir) const;
+    BitGrid &operator|=(const BitGrid &other);
+    bool intersects(const BitGrid &other) const;
+};
+
+#endif // HEADER_BIT_GRID
@@ -0,0 +1,120 @@
+#ifndef HEADER_CHUNKED_ARRAY
+#define HEADER_CHUNKED_ARRAY
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// An array split into equally sized chunks that copies of the array share.
+// Copying costs two pointers per chunk, and a chunk is only duplicated when
+// it's written to by an array that doesn't own it. New chunks all share a
+// single zero-filled chunk until they're first written to.
+//
+// Each chunk records the one array that may write to it in place. Copying an
+// array hands its chunks over to nobody, so both copies duplicate a chunk on
+// their next write to it. Different copies can be read and written from
+// different threads, and one array can be copied from several threads at
+// once, but an array must not be copied while another thread writes to it.
+template <typename T>
+class ChunkedArray {
+    struct Chunk {
+        std::unique_ptr<T[]> elements;
+        // id of the array that may write to the elements, 0 while shared
+        std::atomic<uint64_t> owner{0};
+    };
+
+    static uint64_t newId() {
+        static std::atomic<uint64_t> nextId{1};
+        return nextId.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t chunkSize = 0;
+    uint64_t id = newId();
+    // the elements of each chunk, and the chunk holding them, which is null
+    // for borrowed chunks
+    std::vector<const T *> data;
+    std::vector<std::shared_ptr<Chunk>> chunks;
+    std::shared_ptr<Chunk> zeroChunk;
+    // keeps the memory of borrowed chunks alive
+    std::shared_ptr<const void> borrowedFrom;
+
+public:
+    ChunkedArray() = default;
+    ChunkedArray(size_t numChunks, size_t chunkSize) : chunkSize{chunkSize} {
+        zeroChunk = std::make_shared<Chunk>();
+        zeroChunk->elements.reset(new T[chunkSize]());
+        appendChunks(numChunks);
+    }
+
+    ChunkedArray(const ChunkedArray &other)
+        : chunkSize{other.chunkSize}, data{other.data}, chunks{other.chunks},
+          zeroChunk{other.zeroChunk}, borrowedFrom{other.borrowedFrom} {
+        for (const std::shared_ptr<Chunk> &chunk : chunks) {
+            if (chunk) {
+                chunk->owner.store(0, std::memory_order_release);
+            }
+        }
+    }
+    ChunkedArray(ChunkedArray &&other) noexcept
+        : chunkSize{other.chunkSize}, data{std::move(other.data)}, chunks{std::move(other.chunks)},
+          zeroChunk{std::move(other.zeroChunk)}, borrowedFrom{std::move(other.borrowedFrom)} {
+        // the chunks this array owns now are other's, so other can't keep its id
+        std::swap(id, other.id);
+    }
+    ChunkedArray &operator=(const ChunkedArray &other) {
+        return *this = ChunkedArray{other};
+    }
+    ChunkedArray &operator=(ChunkedArray &&other) noexcept {
+        chunkSize = other.chunkSize;
+        data = std::move(other.data);
+        chunks = std::move(other.chunks);
+        zeroChunk = std::move(other.zeroChunk);
+        borrowedFrom = std::move(other.borrowedFrom);
+        std::swap(id, other.id);
+        return *this;
+    }
+
+    size_t numChunks() const {
+        return data.size();
+    }
+    size_t chunkLength() const {
+        return chunkSize;
+    }
+
+    void appendChunks(size_t count) {
+        data.insert(data.end(), count, zeroChunk->elements.get());
+        chunks.insert(chunks.end(), count, zeroChunk);
+    }
+
+    // Uses chunkLength() elements at elements as chunk c, kept alive by owner
+    // (e.g. a mapped file). No array owns it, so it's copied out before the
+    // first write and the memory at elements is never written to.
+    template <typename Owner>
+    void borrowChunk(size_t c, const std::shared_ptr<Owner> &owner, const T *elements) {
+        borrowedFrom = owner;
+        data[c] = elements;
+        chunks[c] = nullptr;
+    }
+
+    const T *chunk(size_t c) const {
+        return data[c];
+    }
+    T *mutableChunk(size_t c) {
+        std::shared_ptr<Chunk> &current = chunks[c];
+        if (!current || current->owner.load(std::memory_order_acquire) != id) {
+            auto copy = std::make_shared<Chunk>();
+            copy->elements.reset(new T[chunkSize]);
+            std::copy_n(data[c], chunkSize, copy->elements.get());
+            copy->owner.store(id, std::memory_order_relaxed);
+            current = std::move(copy);
+            data[c] = current->elements.get();
+        }
+        return current->elements.get();
+    }
+};
+
+#endif // HEADER_CHUNKED_ARRAY
@@ -0,0 +1,272 @@
+#ifndef HEADER_FIXED_VOXELS
+#define HEADER_FIXED_VOXELS
+
+#include "Direction.h"
+#include "Pos.h"
+#include "Voxels.h"
+#include "utils.h"
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+// A fixed number of bits packed into as few 64-bit words as possible, so
+// that a 4x4x4 grid fits in a single register.
+template <int Bits>
+class Bitboard {
+    static constexpr int numWords = (Bits + 63) / 64;
+    std::array<uint64_t, numWords> words{};
+
+public:
+    constexpr bool test(int i) const {
+        return (words[i >> 6] >> (i & 63)) & 1;
+    }
+    constexpr void set(int i) {
+        words[i >> 6] |= uint64_t{1} << (i & 63);
+    }
+    constexpr void reset(int i) {
+        words[i >> 6] &= ~(uint64_t{1} << (i & 63));
+    }
+
+    constexpr bool any() const {
+        for (uint64_t word : words) {
+            if (word != 0) return true;
+        }
+        return false;
+    }
+    int count() const {
+        int count = 0;
+        for (uint64_t word : words) {
+            count += popcount(word);
+        }
+        return count;
+    }
+
+    constexpr Bitboard operator|(const Bitboard &other) const {
+        Bitboard result;
+        for (int i = 0; i < numWords; ++i) {
+            result.words[i] = words[i] | other.words[i];
+        }
+        return result;
+    }
+    constexpr Bitboard operator&(const Bitboard &other) const {
+        Bitboard result;
+        for (int i = 0; i < numWords; ++i) {
+            result.words[i] = words[i] & other.words[i];
+        }
+        return result;
+    }
+    constexpr Bitboard &operator|=(const Bitboard &other) {
+        return *this = *this | other;
+    }
+    bool operator==(const Bitboard &other) const {
+        return words == other.words;
+    }
+
+    // Moves every bit up (towards bit Bits - 1) or down by n positions.
+    // Bits shifted up past the end can land in the unused high bits of the
+    // last word, so callers only shift bits that stay in range.
+    constexpr Bitboard shiftedUp(int n) const {
+        Bitboard result;
+        int wordShift = n >> 6, bitShift = n & 63;
+        for (int i = numWords - 1; i >= wordShift; --i) {
+            result.words[i] = words[i - wordShift] << bitShift;
+            if (i > wordShift && bitShift > 0) {
+                result.words[i] |= words[i - wordShift - 1] >> (64 - bitShift);
+            }
+        }
+        return result;
+    }
+    constexpr Bitboard shiftedDown(int n) const {
+        Bitboard result;
+        int wordShift = n >> 6, bitShift = n & 63;
+        for (int i = 0; i + wordShift < numWords; ++i) {
+            result.words[i] = words[i + wordShift] >> bitShift;
+            if (i + wordShift + 1 < numWords && bitShift > 0) {
+                result.words[i] |= words[i + wordShift + 1] << (64 - bitShift);
+            }
+        }
+        return result;
+    }
+};
+
+// Voxels of an X * Y * Z grid whose neighbour in each direction is inside
+// the grid, built at compile time
+template <int X, int Y, int Z>
+constexpr std::array<Bitboard<X * Y * Z>, 6> makeStepMasks() {
+    std::array<Bitboard<X * Y * Z>, 6> masks{};
+    for (int x = 0; x < X; ++x) {
+        for (int y = 0; y < Y; ++y) {
+            for (int z = 0; z < Z; ++z) {
+                int index = (x * Y + y) * Z + z;
+                if (x + 1 < X) masks[Direction::XP].set(index);
+                if (x > 0) masks[Direction::XN].set(index);
+                if (y + 1 < Y) masks[Direction::YP].set(index);
+                if (y > 0) masks[Direction::YN].set(index);
+                if (z + 1 < Z) masks[Direction::ZP].set(index);
+                if (z > 0) masks[Direction::ZN].set(index);
+            }
+        }
+    }
+    return masks;
+}
+
+template <int X, int Y, int Z>
+constexpr std::array<Bitboard<X * Y * Z>, 6> stepMasks = makeStepMasks<X, Y, Z>();
+
+// A grid whose size is known at compile time, for small puzzles such as the
+// default 3x3x3 cube. Occupancy and every piece are bitboards of X * Y * Z
+// bits, with bit (x * Y + y) * Z + z for each voxel, so a step in any
+// direction is a shift by a constant and whole pieces are moved, swept and
+// tested for collisions a word at a time.
+template <int X, int Y, int Z, int MaxLabel = 15>
+class FixedVoxels {
+public:
+    static constexpr int numVoxels = X * Y * Z;
+    static constexpr int maxLabel = MaxLabel;
+    using Board = Bitboard<numVoxels>;
+
+private:
+    Board occupied;
+    // pieces[label] holds the voxels with that label, pieces[0] is unused
+    std::array<Board, MaxLabel + 1> pieces{};
+
+    static constexpr int stride(Direction::Value dir) {
+        switch (dir) {
+            case Direction::XP: case Direction::XN: return Y * Z;
+            case Direction::YP: case Direction::YN: return Z;
+            default: return 1;
+        }
+    }
+
+    static int indexOf(Pos p) {
+        return (p.x * Y + p.y) * Z + p.z;
+    }
+
+public:
+    FixedVoxels() = default;
+
+    // Copies a grid that fits inside this one, e.g. to verify a generated
+    // puzzle. The rest stays empty, which doesn't change which pieces can
+    // be taken out.
+    template <typename Label>
+    explicit FixedVoxels(const BasicVoxels<Label> &v) {
+        if (v.maxX() > X || v.maxY() > Y || v.maxZ() > Z) {
+            std::cerr << "Can't copy a " << v.maxX() << "x" << v.maxY() << "x" << v.maxZ()
+                << " grid into a " << X << "x" << Y << "x" << Z << " one" << std::endl;
+            exit(1);
+        }
+        v.forEachVoxel([&](Pos p, int label) {
+            set(p, label);
+        });
+    }
+
+    // Moves every voxel of board one step in direction dir, dropping any
+    // that would leave the grid
+    static constexpr Board shifted(const Board &board, Direction::Value dir) {
+        Board movable = board & stepMasks<X, Y, Z>[dir];
+        bool up = dir == Direction::XP || dir == Direction::YP || dir == Direction::ZP;
+        return up ? movable.shiftedUp(stride(dir)) : movable.shiftedDown(stride(dir));
+    }
+
+    // Every position board passes through when moved any distance in
+    // direction dir, not counting where it starts
+    static constexpr Board swept(const Board &board, Direction::Value dir) {
+        Board result;
+        Board moved = board;
+        for (int i = 1; i < X || i < Y || i < Z; ++i) {
+            moved = shifted(moved, dir);
+            result |= moved;
+        }
+        return result;
+    }
+
+    bool isInRange(Pos p) const {
+        return (unsigned)p.x < (unsigned)X && (unsigned)p.y < (unsigned)Y && (unsigned)p.z < (unsigned)Z;
+    }
+    bool existsAt(Pos p) const {
+        return isInRange(p) && occupied.test(indexOf(p));
+    }
+    bool isUnassigned(Pos p) const {
+        return isInRange(p) && pieces[1].test(indexOf(p));
+    }
+
+    int operator[](Pos p) const {
+        if (!existsAt(p)) return 0;
+        int index = indexOf(p);
+        for (int label = 1; label <= MaxLabel; ++label) {
+            if (pieces[label].test(index)) return label;
+        }
+        return 0;
+    }
+
+    void set(Pos p, int label) {
+        if (!isInRange(p) || label < 0 || label > MaxLabel) {
+            std::cerr << "Can't set label " << label << " at " << p << " in a "
+                << X << "x" << Y << "x" << Z << " grid with labels up to " << MaxLabel << std::endl;
+            exit(1);
+        }
+        int index = indexOf(p);
+        for (Board &piece : pieces) {
+            piece.reset(index);
+        }
+        if (label == 0) {
+            occupied.reset(index);
+        } else {
+            occupied.set(index);
+            pieces[label].set(index);
+        }
+    }
+
+    const Board &occupancy() const {
+        return occupied;
+    }
+    const Board &piece(int label) const {
+        return pieces[label];
+    }
+
+    int maxPieceIdx() const {
+        for (int label = MaxLabel; label > 0; --label) {
+            if (pieces[label].any()) return label;
+        }
+        return 0;
+    }
+
+    // Bit `1 << dir` is set if there's a voxel next to p in direction dir
+    int neighbourMaskAt(Pos p) const {
+        int mask = 0;
+        for (Direction d : ALL_DIRECTIONS) {
+            if (existsAt(p.nextInDirection(d))) mask |= 1 << d;
+        }
+        return mask;
+    }
+
+    // Same rule as Voxels: a piece is blocked in a direction if moving it
+    // any distance that way runs into a piece with a higher label
+    bool isPieceBlocked(int label, Direction dir) const {
+        Board higher;
+        for (int other = label + 1; other <= MaxLabel; ++other) {
+            higher |= pieces[other];
+        }
+        return (swept(pieces[label], dir) & higher).any();
+    }
+
+    // True if every piece can be moved out in some direction once the
+    // pieces with higher labels are gone
+    bool canDisassemble() const {
+        for (int label = 2; label <= maxPieceIdx(); ++label) {
+            bool free = false;
+            for (Direction d : ALL_DIRECTIONS) {
+                if (!isPieceBlocked(label, d)) {
+                    free = true;
+                    break;
+                }
+            }
+            if (!free) return false;
+        }
+        return true;
+    }
+};
+
+#endif // HEADER_FIXED_VOXELS
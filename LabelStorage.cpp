@@ -0,0 +1,40 @@
+#include "LabelStorage.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+template <typename Label>
+LabelStorage<Label>::LabelStorage(std::shared_ptr<MappedFile> file, size_t offset, size_t count)
+    : file{std::move(file)} {
+    resize(count);
+    const Label *labels = reinterpret_cast<const Label *>(this->file->data() + offset);
+    size_t fullChunks = count >> chunkShift;
+    for (size_t c = 0; c < fullChunks; ++c) {
+        chunks.borrowChunk(c, this->file, labels + (c << chunkShift));
+    }
+    // the last chunk would reach past the end of the file, so it's copied
+    size_t tail = count & chunkMask;
+    if (tail > 0) {
+        std::copy_n(labels + (fullChunks << chunkShift), tail, chunks.mutableChunk(fullChunks));
+    }
+}
+
+template <typename Label>
+bool LabelStorage<Label>::isMapped() const {
+    return file != nullptr;
+}
+
+template <typename Label>
+void LabelStorage<Label>::resize(size_t newCount) {
+    if (chunks.chunkLength() == 0) {
+        chunks = ChunkedArray<Label>{0, size_t{1} << chunkShift};
+    }
+    size_t neededChunks = (newCount + chunkMask) >> chunkShift;
+    if (neededChunks > chunks.numChunks()) {
+        chunks.appendChunks(neededChunks - chunks.numChunks());
+    }
+    count = std::max(count, newCount);
+}
+
+template class LabelStorage<uint8_t>;
@@ -0,0 +1,54 @@
+#ifndef HEADER_LABEL_STORAGE
+#define HEADER_LABEL_STORAGE
+
+#include "ChunkedArray.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+
+// The label array behind a grid, in chunks of 4096 labels that copies of the
+// grid share until one of them writes to a chunk. Chunks either live in
+// memory or are read from a mapped file, so that a volume's labels are used
+// where they are instead of being copied; a mapped chunk moves into memory
+// when it's written.
+template <typename Label>
+class LabelStorage {
+    static constexpr int chunkShift = 12;
+    static constexpr size_t chunkMask = (size_t{1} << chunkShift) - 1;
+
+    ChunkedArray<Label> chunks;
+    std::shared_ptr<MappedFile> file;
+    size_t count = 0;
+
+public:
+    LabelStorage() = default;
+    // `count` labels starting `offset` bytes into the file
+    LabelStorage(std::shared_ptr<MappedFile> file, size_t offset, size_t count);
+
+    bool isMapped() const;
+    size_t size() const {
+        return count;
+    }
+    // Grows the storage, new labels are 0
+    void resize(size_t newCount);
+
+    Label operator[](size_t index) const {
+        return chunks.chunk(index >> chunkShift)[index & chunkMask];
+    }
+    void set(size_t index, Label label) {
+        chunks.mutableChunk(index >> chunkShift)[index & chunkMask] = label;
+    }
+
+    // Calls f(labels, count) for each run of consecutive labels in order
+    template <typename F>
+    void forEachChunk(F f) const {
+        for (size_t c = 0; c < chunks.numChunks(); ++c) {
+            size_t start = c << chunkShift;
+            f(chunks.chunk(c), std::min(count - start, chunks.chunkLength()));
+        }
+    }
+};
+
+#endif // HEADER_LABEL_STORAGE
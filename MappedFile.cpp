@@ -0,0 +1,87 @@
+#include "MappedFile.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string &filename) {
+    fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        std::cerr << "Failed to open file " << filename << ": error " << GetLastError() << std::endl;
+        exit(1);
+    }
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(fileHandle, &fileSize);
+    length = (size_t)fileSize.QuadPart;
+    // empty files can't be mapped, and don't need to be
+    if (length == 0) return;
+    mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle != nullptr) {
+        address = static_cast<const char *>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (address == nullptr) {
+        std::cerr << "Failed to map file " << filename << ": error " << GetLastError() << std::endl;
+        exit(1);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (address != nullptr) UnmapViewOfFile(address);
+    if (mappingHandle != nullptr) CloseHandle(mappingHandle);
+    CloseHandle(fileHandle);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open file " << filename << ": " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        std::cerr << "Failed to read size of file " << filename << ": " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    length = (size_t)info.st_size;
+    // empty files can't be mapped, and don't need to be
+    if (length > 0) {
+        void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            std::cerr << "Failed to map file " << filename << ": " << strerror(errno) << std::endl;
+            exit(1);
+        }
+        address = static_cast<const char *>(mapped);
+    }
+    // the mapping keeps its own reference to the file
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (address != nullptr) munmap(const_cast<char *>(address), length);
+}
+
+#endif
+
+const char *MappedFile::data() const {
+    return address;
+}
+
+size_t MappedFile::size() const {
+    return length;
+}
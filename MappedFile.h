@@ -0,0 +1,28 @@
+#ifndef HEADER_MAPPED_FILE
+#define HEADER_MAPPED_FILE
+
+#include <cstddef>
+#include <string>
+
+// A whole file mapped into memory. Pages are read from disk as they're first
+// touched and can be dropped again under memory pressure. The mapping is
+// read-only, so the file can't be changed through it.
+class MappedFile {
+    const char *address = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void *fileHandle = nullptr;
+    void *mappingHandle = nullptr;
+#endif
+
+public:
+    explicit MappedFile(const std::string &filename);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const;
+    size_t size() const;
+};
+
+#endif // HEADER_MAPPED_FILE
@@ -0,0 +1,547 @@
+#include "Mesh.h"
+#include "MappedFile.h"
+#include "Pos.h"
+#include "utils.h"
+#include "VoxelsView.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string_view>
+#include <thread>
+
+Mesh::Mesh(std::vector<Triangle> triangles) : triangles{std::move(triangles)} {}
+
+Mesh Mesh::readFile(const std::string &filename) {
+    if (hasExtension(filename, ".stl")) {
+        return readStl(filename);
+    }
+    if (hasExtension(filename, ".obj")) {
+        return readObj(filename);
+    }
+    std::cerr << "Unknown mesh format " << filename << ", expected .stl or .obj" << std::endl;
+    exit(1);
+}
+
+// Calls f(token) for each whitespace separated token from pos up to end
+template <typename F>
+static void forEachToken(const char *pos, const char *end, F f) {
+    while (true) {
+        while (pos != end && std::isspace((unsigned char)*pos)) ++pos;
+        if (pos == end) return;
+        const char *start = pos;
+        while (pos != end && !std::isspace((unsigned char)*pos)) ++pos;
+        f(std::string_view{start, (size_t)(pos - start)});
+    }
+}
+
+static bool parseFloat(std::string_view token, float &value) {
+    // the mapped file isn't null terminated, so numbers are copied out
+    char buffer[64];
+    if (token.empty() || token.size() >= sizeof(buffer)) return false;
+    memcpy(buffer, token.data(), token.size());
+    buffer[token.size()] = '\0';
+    char *parsedEnd = nullptr;
+    value = std::strtof(buffer, &parsedEnd);
+    return parsedEnd == buffer + token.size();
+}
+
+Mesh Mesh::readStl(const std::string &filename) {
+    MappedFile file{filename};
+    const char *data = file.data();
+    size_t size = file.size();
+    std::vector<Triangle> triangles;
+    // Binary files have an 80 byte header, a triangle count and 50 bytes
+    // per triangle. Some of them start with "solid" like ASCII ones, so
+    // they're told apart by their size.
+    uint32_t count = 0;
+    if (size >= 84) {
+        memcpy(&count, data + 80, 4);
+    }
+    if (size >= 84 && size == 84 + (size_t)count * 50) {
+        triangles.resize(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            // each triangle is a normal, three vertices and two attribute bytes
+            memcpy(triangles[i].vertices, data + 84 + (size_t)i * 50 + 12, 36);
+        }
+        return Mesh{std::move(triangles)};
+    }
+    if (size < 5 || memcmp(data, "solid", 5) != 0) {
+        std::cerr << filename << " is not an STL file" << std::endl;
+        exit(1);
+    }
+    // ASCII files list three "vertex x y z" lines for each facet
+    std::vector<float> coords;
+    int expectCoords = 0;
+    forEachToken(data, data + size, [&](std::string_view token) {
+        if (expectCoords > 0) {
+            float value;
+            if (!parseFloat(token, value)) {
+                std::cerr << "Expected a coordinate in " << filename << ", found '" << token << "'" << std::endl;
+                exit(1);
+            }
+            coords.push_back(value);
+            --expectCoords;
+        } else if (token == "vertex") {
+            expectCoords = 3;
+        }
+    });
+    if (expectCoords > 0 || coords.size() % 9 != 0) {
+        std::cerr << filename << " has a facet without three vertices" << std::endl;
+        exit(1);
+    }
+    triangles.resize(coords.size() / 9);
+    memcpy(triangles.data(), coords.data(), coords.size() * sizeof(float));
+    return Mesh{std::move(triangles)};
+}
+
+Mesh Mesh::readObj(const std::string &filename) {
+    MappedFile file{filename};
+    const char *pos = file.data();
+    const char *end = pos + file.size();
+    std::vector<std::array<float, 3>> vertices;
+    std::vector<Triangle> triangles;
+    std::vector<int> face;
+    int lineNumber = 0;
+    while (pos != end) {
+        const char *lineEnd = std::find(pos, end, '\n');
+        ++lineNumber;
+        int field = 0;
+        enum { Other, Vertex, Face } kind = Other;
+        std::array<float, 3> vertex{};
+        face.clear();
+        forEachToken(pos, lineEnd, [&](std::string_view token) {
+            if (field++ == 0) {
+                kind = token == "v" ? Vertex : token == "f" ? Face : Other;
+                return;
+            }
+            if (kind == Vertex && field <= 4) {
+                // anything after x, y and z (e.g. w or a colour) is ignored
+                if (!parseFloat(token, vertex[field - 2])) {
+                    std::cerr << "Bad vertex coordinate '" << token << "' on line " << lineNumber
+                        << " of " << filename << std::endl;
+                    exit(1);
+                }
+            } else if (kind == Face) {
+                // "v", "v/vt", "v//vn" or "v/vt/vn", negative indices count back
+                // from the last vertex
+                char *indexEnd = nullptr;
+                std::string number{token.substr(0, token.find('/'))};
+                long index = std::strtol(number.c_str(), &indexEnd, 10);
+                if (index < 0) index += (long)vertices.size() + 1;
+                if (number.empty() || *indexEnd != '\0' || index < 1 || index > (long)vertices.size()) {
+                    std::cerr << "Bad vertex index '" << token << "' on line " << lineNumber
+                        << " of " << filename << std::endl;
+                    exit(1);
+                }
+                face.push_back((int)index - 1);
+            }
+        });
+        if (kind == Vertex) {
+            if (field < 4) {
+                std::cerr << "Vertex with fewer than three coordinates on line " << lineNumber
+                    << " of " << filename << std::endl;
+                exit(1);
+            }
+            vertices.push_back(vertex);
+        } else if (kind == Face) {
+            // polygons are split into a fan of triangles
+            for (size_t i = 2; i < face.size(); ++i) {
+                Triangle t;
+                int corners[3] = {face[0], face[i - 1], face[i]};
+                for (int c = 0; c < 3; ++c) {
+                    memcpy(t.vertices[c], vertices[corners[c]].data(), sizeof(t.vertices[c]));
+                }
+                triangles.push_back(t);
+            }
+        }
+        pos = lineEnd == end ? end : lineEnd + 1;
+    }
+    return Mesh{std::move(triangles)};
+}
+
+// Key of the line through p along `axis`, from the other two coordinates
+static uint64_t lineKey(const int p[3], int axis) {
+    int u = (axis + 1) % 3, w = (axis + 2) % 3;
+    return (uint64_t)axis << 62 | (uint64_t)(p[u] + 1) << 31 | (uint64_t)(p[w] + 1);
+}
+
+Mesh Mesh::ofPiece(const Voxels &v, int piece) {
+    VoxelsView box = VoxelsView::aroundPiece(v, piece);
+    if (box.isEmpty()) return Mesh{};
+    int lo[3] = {box.min().x, box.min().y, box.min().z};
+    int hi[3] = {box.max().x - 1, box.max().y - 1, box.max().z - 1};
+    // the box around the piece is in range, so its neighbours can be read
+    // from the piece's bits without bounds checks
+    const BitGrid &bits = v.piecePlane(piece);
+    auto inPiece = [&](const int p[3]) {
+        return bits.get(Pos{p[0], p[1], p[2]});
+    };
+
+    // Rectangles of exposed faces, as four corners counter-clockwise seen
+    // from outside the piece
+    std::vector<std::array<std::array<int, 3>, 4>> quads;
+    for (int axis = 0; axis < 3; ++axis) {
+        // u, w and axis are a right-handed basis, so u then w turns
+        // counter-clockwise around +axis
+        int u = (axis + 1) % 3, w = (axis + 2) % 3;
+        int sizeU = hi[u] - lo[u] + 1, sizeW = hi[w] - lo[w] + 1;
+        // which voxels of the layers below, at and above the current one
+        // are in the piece
+        std::vector<char> below((size_t)sizeU * sizeW), current(below.size()), above(below.size());
+        auto readLayer = [&](int layer, std::vector<char> &mask) {
+            int p[3];
+            p[axis] = layer;
+            for (int i = 0; i < sizeU; ++i) {
+                p[u] = lo[u] + i;
+                for (int j = 0; j < sizeW; ++j) {
+                    p[w] = lo[w] + j;
+                    mask[(size_t)i * sizeW + j] = inPiece(p);
+                }
+            }
+        };
+        std::vector<char> exposed(below.size());
+        readLayer(lo[axis] - 1, below);
+        readLayer(lo[axis], current);
+        for (int layer = lo[axis]; layer <= hi[axis]; ++layer) {
+            readLayer(layer + 1, above);
+            for (int side : {1, -1}) {
+                const std::vector<char> &outside = side > 0 ? above : below;
+                for (size_t k = 0; k < exposed.size(); ++k) {
+                    exposed[k] = current[k] && !outside[k];
+                }
+                // each rectangle grows along w as far as it can, then along
+                // u for as long as whole rows of that width are exposed
+                for (int i = 0; i < sizeU; ++i) {
+                    for (int j = 0; j < sizeW; ++j) {
+                        if (!exposed[(size_t)i * sizeW + j]) continue;
+                        int width = 1;
+                        while (j + width < sizeW && exposed[(size_t)i * sizeW + j + width]) ++width;
+                        int height = 1;
+                        while (i + height < sizeU && std::all_of(
+                            &exposed[(size_t)(i + height) * sizeW + j],
+                            &exposed[(size_t)(i + height) * sizeW + j + width],
+                            [](char e) { return e != 0; })) {
+                            ++height;
+                        }
+                        for (int di = 0; di < height; ++di) {
+                            std::fill_n(&exposed[(size_t)(i + di) * sizeW + j], width, 0);
+                        }
+                        std::array<std::array<int, 3>, 4> quad;
+                        int cornerU[4] = {i, i + height, i + height, i};
+                        int cornerW[4] = {j, j, j + width, j + width};
+                        for (int c = 0; c < 4; ++c) {
+                            quad[c][axis] = layer + (side > 0 ? 1 : 0);
+                            quad[c][u] = lo[u] + cornerU[c];
+                            quad[c][w] = lo[w] + cornerW[c];
+                        }
+                        if (side < 0) std::swap(quad[1], quad[3]);
+                        quads.push_back(quad);
+                    }
+                }
+            }
+            std::swap(below, current);
+            std::swap(current, above);
+        }
+    }
+
+    // Every corner, listed on each of the three axis lines through it and
+    // sorted, so that the corners on an edge are a range of the list
+    std::vector<std::pair<uint64_t, int>> lines;
+    lines.reserve(quads.size() * 12);
+    for (const auto &quad : quads) {
+        for (const auto &corner : quad) {
+            for (int axis = 0; axis < 3; ++axis) {
+                lines.push_back({lineKey(corner.data(), axis), corner[axis]});
+            }
+        }
+    }
+    std::sort(lines.begin(), lines.end());
+    lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+
+    std::vector<Triangle> triangles;
+    // cropped grids are moved back to where they were in the original shape
+    Pos offset = v.offset();
+    float shift[3] = {(float)offset.x, (float)offset.y, (float)offset.z};
+    auto addTriangle = [&](const float *a, const float *b, const float *c) {
+        Triangle t;
+        const float *corners[3] = {a, b, c};
+        for (int corner = 0; corner < 3; ++corner) {
+            for (int axis = 0; axis < 3; ++axis) {
+                t.vertices[corner][axis] = corners[corner][axis] + shift[axis];
+            }
+        }
+        triangles.push_back(t);
+    };
+    std::vector<std::array<float, 3>> outline;
+    for (const auto &quad : quads) {
+        // the outline of the rectangle, with every corner of another
+        // rectangle that lies on one of its edges
+        outline.clear();
+        int cornerIndices[4];
+        for (int c = 0; c < 4; ++c) {
+            const auto &from = quad[c], &to = quad[(c + 1) % 4];
+            cornerIndices[c] = (int)outline.size();
+            outline.push_back({(float)from[0], (float)from[1], (float)from[2]});
+            int axis = from[0] != to[0] ? 0 : from[1] != to[1] ? 1 : 2;
+            uint64_t key = lineKey(from.data(), axis);
+            int first = std::min(from[axis], to[axis]), last = std::max(from[axis], to[axis]);
+            auto begin = std::upper_bound(lines.begin(), lines.end(), std::make_pair(key, first));
+            auto end = std::lower_bound(lines.begin(), lines.end(), std::make_pair(key, last));
+            size_t edgeStart = outline.size();
+            for (auto it = begin; it != end; ++it) {
+                std::array<float, 3> point{(float)from[0], (float)from[1], (float)from[2]};
+                point[axis] = (float)it->second;
+                outline.push_back(point);
+            }
+            if (from[axis] > to[axis]) {
+                std::reverse(outline.begin() + edgeStart, outline.end());
+            }
+        }
+        int n = (int)outline.size();
+        // A fan from a corner with no extra points on either of its edges
+        // covers every edge segment without degenerate triangles. Without
+        // one, the fan starts from the middle of the rectangle instead.
+        int fanCorner = -1;
+        for (int c = 0; c < 4 && fanCorner < 0; ++c) {
+            int next = c == 3 ? n : cornerIndices[c + 1];
+            int previousEdge = c == 0 ? n - cornerIndices[3] : cornerIndices[c] - cornerIndices[c - 1];
+            if (next - cornerIndices[c] == 1 && previousEdge == 1) fanCorner = cornerIndices[c];
+        }
+        if (fanCorner >= 0) {
+            for (int i = 1; i + 1 < n; ++i) {
+                addTriangle(outline[fanCorner].data(), outline[(fanCorner + i) % n].data(),
+                    outline[(fanCorner + i + 1) % n].data());
+            }
+        } else {
+            float middle[3];
+            for (int axis = 0; axis < 3; ++axis) {
+                middle[axis] = (outline[cornerIndices[0]][axis] + outline[cornerIndices[2]][axis]) / 2;
+            }
+            for (int i = 0; i < n; ++i) {
+                addTriangle(middle, outline[i].data(), outline[(i + 1) % n].data());
+            }
+        }
+    }
+    return Mesh{std::move(triangles)};
+}
+
+void Mesh::writeStl(const std::string &filename) const {
+    std::ofstream fout{filename, std::ios::binary};
+    if (!fout) {
+        std::cerr << "Failed to open file " << filename << ": " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    char header[80] = "binary STL";
+    fout.write(header, sizeof(header));
+    uint32_t count = (uint32_t)triangles.size();
+    fout.write(reinterpret_cast<const char *>(&count), 4);
+    for (const Triangle &t : triangles) {
+        // normals follow the right-hand rule from the vertex order
+        const float *a = t.vertices[0], *b = t.vertices[1], *c = t.vertices[2];
+        float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+        float normal[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+        float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (length > 0) {
+            for (float &n : normal) n /= length;
+        }
+        char record[50] = {};
+        memcpy(record, normal, 12);
+        memcpy(record + 12, t.vertices, 36);
+        fout.write(record, sizeof(record));
+    }
+    if (!fout) {
+        std::cerr << "Failed to write file " << filename << ": " << strerror(errno) << std::endl;
+        exit(1);
+    }
+}
+
+int Mesh::numTriangles() const {
+    return (int)triangles.size();
+}
+
+namespace {
+
+struct Point2 {
+    double x, y;
+};
+
+// Twice the signed area of (a, b, p), positive if p is left of a -> b. It
+// is computed from the lower of a and b, so that both triangles sharing an
+// edge get exactly opposite values and every crossing is counted once.
+double edgeFunction(Point2 a, Point2 b, Point2 p) {
+    if (b.x < a.x || (b.x == a.x && b.y < a.y)) {
+        return -((a.x - b.x) * (p.y - b.y) - (a.y - b.y) * (p.x - b.x));
+    }
+    return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+}
+
+// Whether points exactly on the edge a -> b of a counter-clockwise triangle
+// belong to it. Reversing the edge flips the answer, so points on an edge
+// shared by two triangles belong to exactly one of them.
+bool ownsEdge(Point2 a, Point2 b) {
+    return b.y > a.y || (b.y == a.y && b.x < a.x);
+}
+
+// A run of filled voxels z0 <= z < z1 in row y of a slab
+struct Run {
+    int y, z0, z1;
+};
+
+}
+
+Voxels Mesh::voxelize(int resolution, VoxelLayout layout) const {
+    if (resolution <= 0) {
+        std::cerr << "Resolution must be greater than 0" << std::endl;
+        exit(1);
+    }
+    if (triangles.empty()) {
+        std::cerr << "Mesh has no triangles" << std::endl;
+        exit(1);
+    }
+    double lo[3], hi[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        lo[axis] = hi[axis] = triangles[0].vertices[0][axis];
+    }
+    for (const Triangle &t : triangles) {
+        for (const float *v : t.vertices) {
+            for (int axis = 0; axis < 3; ++axis) {
+                lo[axis] = std::min(lo[axis], (double)v[axis]);
+                hi[axis] = std::max(hi[axis], (double)v[axis]);
+            }
+        }
+    }
+    double longest = std::max({hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]});
+    if (!(longest > 0)) {
+        std::cerr << "Mesh has no extent" << std::endl;
+        exit(1);
+    }
+    double voxelSize = longest / resolution;
+    int sizes[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        sizes[axis] = std::clamp((int)std::ceil((hi[axis] - lo[axis]) / voxelSize), 1, resolution);
+    }
+    // voxel centres along an axis are at lo + (i + 0.5) * voxelSize
+    auto centre = [&](int axis, int i) {
+        return lo[axis] + (i + 0.5) * voxelSize;
+    };
+    // first and last voxel whose centre is within [from, to] along an axis
+    auto centresBetween = [&](int axis, double from, double to, int &first, int &last) {
+        first = std::max(0, (int)std::ceil((from - lo[axis]) / voxelSize - 0.5));
+        last = std::min(sizes[axis] - 1, (int)std::floor((to - lo[axis]) / voxelSize - 0.5));
+        return first <= last;
+    };
+
+    // Triangles are binned by the x slabs whose centre plane they reach,
+    // counting first so that every bin is a range of one array
+    std::vector<int> binStarts(sizes[0] + 1, 0);
+    std::vector<int> firstSlab(triangles.size()), lastSlab(triangles.size());
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        const Triangle &t = triangles[i];
+        double minX = std::min({t.vertices[0][0], t.vertices[1][0], t.vertices[2][0]});
+        double maxX = std::max({t.vertices[0][0], t.vertices[1][0], t.vertices[2][0]});
+        if (!centresBetween(0, minX, maxX, firstSlab[i], lastSlab[i])) continue;
+        for (int x = firstSlab[i]; x <= lastSlab[i]; ++x) {
+            ++binStarts[x + 1];
+        }
+    }
+    for (int x = 0; x < sizes[0]; ++x) {
+        binStarts[x + 1] += binStarts[x];
+    }
+    std::vector<int> bins(binStarts[sizes[0]]);
+    {
+        std::vector<int> fill(binStarts.begin(), binStarts.end() - 1);
+        for (size_t i = 0; i < triangles.size(); ++i) {
+            for (int x = firstSlab[i]; x <= lastSlab[i]; ++x) {
+                bins[fill[x]++] = (int)i;
+            }
+        }
+    }
+
+    // Each slab is filled on its own, by whichever thread takes it next.
+    // A ray along z through every voxel centre of the slab is crossed with
+    // the triangles, and voxels between the 1st and 2nd, 3rd and 4th, ...
+    // crossings are inside.
+    std::vector<std::vector<Run>> slabRuns(sizes[0]);
+    std::atomic<int> nextSlab{0};
+    std::atomic<int> oddRows{0};
+    auto fillSlabs = [&] {
+        std::vector<std::vector<double>> crossings(sizes[1]);
+        for (int x; (x = nextSlab++) < sizes[0];) {
+            double xc = centre(0, x);
+            for (int i = binStarts[x]; i < binStarts[x + 1]; ++i) {
+                const Triangle &t = triangles[bins[i]];
+                Point2 a{t.vertices[0][0], t.vertices[0][1]};
+                Point2 b{t.vertices[1][0], t.vertices[1][1]};
+                Point2 c{t.vertices[2][0], t.vertices[2][1]};
+                double za = t.vertices[0][2], zb = t.vertices[1][2], zc = t.vertices[2][2];
+                double area = edgeFunction(a, b, c);
+                // triangles seen edge on from z are never crossed
+                if (area == 0) continue;
+                if (area < 0) {
+                    std::swap(b, c);
+                    std::swap(zb, zc);
+                }
+                int firstY, lastY;
+                if (!centresBetween(1, std::min({a.y, b.y, c.y}), std::max({a.y, b.y, c.y}), firstY, lastY)) continue;
+                for (int y = firstY; y <= lastY; ++y) {
+                    Point2 p{xc, centre(1, y)};
+                    double wa = edgeFunction(b, c, p);
+                    double wb = edgeFunction(c, a, p);
+                    double wc = edgeFunction(a, b, p);
+                    if (wa < 0 || (wa == 0 && !ownsEdge(b, c))) continue;
+                    if (wb < 0 || (wb == 0 && !ownsEdge(c, a))) continue;
+                    if (wc < 0 || (wc == 0 && !ownsEdge(a, b))) continue;
+                    crossings[y].push_back((wa * za + wb * zb + wc * zc) / (wa + wb + wc));
+                }
+            }
+            std::vector<Run> &runs = slabRuns[x];
+            for (int y = 0; y < sizes[1]; ++y) {
+                std::vector<double> &row = crossings[y];
+                if (row.empty()) continue;
+                std::sort(row.begin(), row.end());
+                if (row.size() % 2 != 0) ++oddRows;
+                for (size_t i = 0; i + 1 < row.size(); i += 2) {
+                    int z0, z1;
+                    if (centresBetween(2, row[i], row[i + 1], z0, z1)) {
+                        runs.push_back({y, z0, z1 + 1});
+                    }
+                }
+                row.clear();
+            }
+        }
+    };
+    int numThreads = std::max(1, std::min((int)std::thread::hardware_concurrency(), sizes[0]));
+    std::vector<std::thread> threads;
+    for (int i = 1; i < numThreads; ++i) {
+        threads.emplace_back(fillSlabs);
+    }
+    fillSlabs();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    if (oddRows > 0) {
+        std::cerr << "Mesh isn't closed: " << oddRows << " rows of voxels cross it an odd number of times"
+            << std::endl;
+    }
+
+    // the grid's bookkeeping isn't thread safe, so the runs are written here
+    Voxels result{sizes[2], sizes[1], sizes[0], layout};
+    for (int x = 0; x < sizes[0]; ++x) {
+        for (const Run &run : slabRuns[x]) {
+            for (int z = run.z0; z < run.z1; ++z) {
+                result[Pos{x, run.y, z}] = 1;
+            }
+        }
+    }
+    return result;
+}
@@ -0,0 +1,45 @@
+#ifndef HEADER_MESH
+#define HEADER_MESH
+
+#include "Voxels.h"
+
+#include <string>
+#include <vector>
+
+struct Triangle {
+    float vertices[3][3];
+};
+
+// A triangle mesh read from an STL (binary or ASCII) or OBJ file, which can
+// be voxelized into a shape for the generator
+class Mesh {
+    std::vector<Triangle> triangles;
+
+    static Mesh readStl(const std::string &filename);
+    static Mesh readObj(const std::string &filename);
+
+public:
+    Mesh() = default;
+    explicit Mesh(std::vector<Triangle> triangles);
+
+    // Picks the format from the file's extension, .stl or .obj
+    static Mesh readFile(const std::string &filename);
+    // The closed surface of the voxels labelled `piece`, one unit per voxel,
+    // at the piece's position in the shape the grid was cropped from.
+    // Coplanar faces are merged into as few rectangles as a greedy sweep
+    // finds, and rectangles are split where a neighbour's corner lies on
+    // their edge, so that the surface has no T-junctions.
+    static Mesh ofPiece(const Voxels &v, int piece);
+
+    void writeStl(const std::string &filename) const;
+
+    int numTriangles() const;
+
+    // Fills every voxel whose centre is inside the mesh, with the longest
+    // side of the mesh's bounding box `resolution` voxels long. Each row of
+    // voxels along z is filled between pairs of crossings with the mesh,
+    // so the mesh must be closed. x slabs are filled on all cores.
+    Voxels voxelize(int resolution, VoxelLayout layout = VoxelLayout::Linear) const;
+};
+
+#endif // HEADER_MESH
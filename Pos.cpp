@@ -24,6 +24,12 @@ bool Pos::operator==(const Pos &other) const {
     return x == other.x && y == other.y && z == other.z;
 }
 
+bool Pos::operator<(const Pos &other) const {
+    if (x != other.x) return x < other.x;
+    if (y != other.y) return y < other.y;
+    return z < other.z;
+}
+
 std::ostream &operator<<(std::ostream &os, const Pos &p) {
     return os << "Pos{" << p.x << ", " << p.y << ", " << p.z << "}";
 }
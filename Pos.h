@@ -11,6 +11,8 @@ struct Pos {
 
     Pos nextInDirection(Direction d) const;
     bool operator==(const Pos &other) const;
+    // Orders positions the way grids are scanned: by x, then y, then z
+    bool operator<(const Pos &other) const;
 
     bool isInLine(const Pos &other, Direction dir) const;
 
@@ -0,0 +1,124 @@
+#include "RayTables.h"
+#include "Voxels.h"
+
+#include <algorithm>
+#include <cstdint>
+
+template <typename Label>
+RayTables<Label>::RayTables(int sizeX, int sizeY, int sizeZ)
+    : sizeX{sizeX}, sizeY{sizeY}, sizeZ{sizeZ} {}
+
+template <typename Label>
+void RayTables<Label>::markDirty(Pos p) {
+    // nothing has been built yet
+    if (rows[0].empty()) return;
+    rows[0][p.y * sizeZ + p.z].dirty = true;
+    rows[1][p.x * sizeZ + p.z].dirty = true;
+    rows[2][p.x * sizeY + p.y].dirty = true;
+}
+
+template <typename Label>
+typename RayTables<Label>::Row &RayTables<Label>::row(
+    const BasicVoxels<Label> &v, Pos p, Direction dir, int &posInRow
+) {
+    if (rows[0].empty()) {
+        rows[0].resize((size_t)sizeY * sizeZ);
+        rows[1].resize((size_t)sizeX * sizeZ);
+        rows[2].resize((size_t)sizeX * sizeY);
+    }
+    int axis = 0;
+    int length = 0;
+    Row *r = nullptr;
+    switch (dir) {
+        case Direction::XP:
+        case Direction::XN:
+            axis = 0;
+            length = sizeX;
+            posInRow = p.x;
+            r = &rows[0][p.y * sizeZ + p.z];
+            break;
+        case Direction::YP:
+        case Direction::YN:
+            axis = 1;
+            length = sizeY;
+            posInRow = p.y;
+            r = &rows[1][p.x * sizeZ + p.z];
+            break;
+        case Direction::ZP:
+        case Direction::ZN:
+            axis = 2;
+            length = sizeZ;
+            posInRow = p.z;
+            r = &rows[2][p.x * sizeY + p.y];
+            break;
+    }
+    if (!r->dirty) {
+        return *r;
+    }
+
+    r->entries.resize(length);
+    r->first = -1;
+    r->last = -1;
+    Pos q = p;
+    int maxSoFar = 0;
+    int unassigned = 0;
+    for (int i = 0; i < length; ++i) {
+        switch (axis) {
+            case 0: q.x = i; break;
+            case 1: q.y = i; break;
+            case 2: q.z = i; break;
+        }
+        int label = v.at(v.indexOf(q));
+        if (label != 0) {
+            if (r->first < 0) r->first = i;
+            r->last = i;
+        }
+        if (label == 1) ++unassigned;
+        maxSoFar = std::max(maxSoFar, label);
+        Entry &entry = r->entries[i];
+        entry.maxFromStart = static_cast<Label>(maxSoFar);
+        // holds just this voxel's label until the backwards pass below
+        entry.maxToEnd = static_cast<Label>(label);
+        entry.unassignedFromStart = unassigned;
+    }
+    maxSoFar = 0;
+    for (int i = length - 1; i >= 0; --i) {
+        Entry &entry = r->entries[i];
+        maxSoFar = std::max<int>(maxSoFar, entry.maxToEnd);
+        entry.maxToEnd = static_cast<Label>(maxSoFar);
+    }
+    r->dirty = false;
+    return *r;
+}
+
+template <typename Label>
+int RayTables<Label>::maxLabelBeyond(const BasicVoxels<Label> &v, Pos p, Direction dir) {
+    int i = 0;
+    const Row &r = row(v, p, dir, i);
+    if (dir == Direction::XP || dir == Direction::YP || dir == Direction::ZP) {
+        return i + 1 < (int)r.entries.size() ? r.entries[i + 1].maxToEnd : 0;
+    }
+    return i > 0 ? r.entries[i - 1].maxFromStart : 0;
+}
+
+template <typename Label>
+int RayTables<Label>::unassignedBeyond(const BasicVoxels<Label> &v, Pos p, Direction dir) {
+    int i = 0;
+    const Row &r = row(v, p, dir, i);
+    if (dir == Direction::XP || dir == Direction::YP || dir == Direction::ZP) {
+        return r.entries.back().unassignedFromStart - r.entries[i].unassignedFromStart;
+    }
+    return i > 0 ? r.entries[i - 1].unassignedFromStart : 0;
+}
+
+template <typename Label>
+int RayTables<Label>::stepsToFarthest(const BasicVoxels<Label> &v, Pos p, Direction dir) {
+    int i = 0;
+    const Row &r = row(v, p, dir, i);
+    if (dir == Direction::XP || dir == Direction::YP || dir == Direction::ZP) {
+        return r.last > i ? r.last - i : 0;
+    }
+    return r.first >= 0 && r.first < i ? i - r.first : 0;
+}
+
+template class RayTables<uint8_t>;
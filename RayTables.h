@@ -0,0 +1,58 @@
+#ifndef HEADER_RAY_TABLES
+#define HEADER_RAY_TABLES
+
+#include "Direction.h"
+#include "Pos.h"
+
+#include <vector>
+
+template <typename Label>
+class BasicVoxels;
+
+// Prefix tables for every row of voxels along each axis, which answer
+// questions about everything beyond a voxel in one direction in constant
+// time. A row is built the first time it is queried, and a write to any of
+// its voxels marks it for rebuilding. No rows are allocated until the first
+// query.
+template <typename Label>
+class RayTables {
+    struct Entry {
+        // highest label from the start of the row up to and including here
+        Label maxFromStart;
+        // highest label from here to the end of the row
+        Label maxToEnd;
+        // number of unassigned voxels from the start of the row up to here
+        int unassignedFromStart;
+    };
+
+    struct Row {
+        bool dirty = true;
+        // first and last occupied position in the row, or -1 if it's empty
+        int first = -1;
+        int last = -1;
+        std::vector<Entry> entries;
+    };
+
+    int sizeX = 0;
+    int sizeY = 0;
+    int sizeZ = 0;
+    std::vector<Row> rows[3];
+
+    Row &row(const BasicVoxels<Label> &v, Pos p, Direction dir, int &posInRow);
+
+public:
+    RayTables() = default;
+    RayTables(int sizeX, int sizeY, int sizeZ);
+
+    void markDirty(Pos p);
+
+    // Highest label strictly beyond p in direction dir, or 0 if there are
+    // no voxels there
+    int maxLabelBeyond(const BasicVoxels<Label> &v, Pos p, Direction dir);
+    int unassignedBeyond(const BasicVoxels<Label> &v, Pos p, Direction dir);
+    // Number of steps from p to the farthest voxel in direction dir, or 0
+    // if there are no voxels there
+    int stepsToFarthest(const BasicVoxels<Label> &v, Pos p, Direction dir);
+};
+
+#endif // HEADER_RAY_TABLES
@@ -48,7 +48,8 @@ VertexData setNormal(VertexData data, Direction dir) {
     return data;
 }
 
-void addCube(float x, float y, float z, VoxelPiece piece, std::vector<VertexData> &data) {
+// Faces in the directions set in `hiddenFaces` are left out
+void addCube(float x, float y, float z, VoxelPiece piece, std::vector<VertexData> &data, int hiddenFaces) {
     const std::vector<VertexData> vertices = {
         buildVertexData(x, y, z, piece),
         buildVertexData(x + 1, y, z, piece),
@@ -75,7 +76,17 @@ void addCube(float x, float y, float z, VoxelPiece piece, std::vector<VertexData
         Direction::YP,
         Direction::ZN,
     };
+    // which neighbour each face is shared with
+    const std::vector<Direction> sides = {
+        Direction::ZN,
+        Direction::XN,
+        Direction::XP,
+        Direction::YN,
+        Direction::YP,
+        Direction::ZP,
+    };
     for (int i = 0; i < (int)indices.size(); ++i) {
+        if (hiddenFaces & (1 << sides[i / 6])) continue;
         int index = indices[i];
         Direction dir = directions[i / 6];
         data.push_back(setNormal(vertices[index], dir));
@@ -84,18 +95,24 @@ void addCube(float x, float y, float z, VoxelPiece piece, std::vector<VertexData
 
 void getVertexData(std::vector<VertexData> &vertexData, const Voxels &v, float time) {
     vertexData.clear();
-    for (int x = 0; x < v.maxX(); ++x) {
-        for (int y = 0; y < v.maxY(); ++y) {
-            for (int z = 0; z < v.maxZ(); ++z) {
-                if (v.existsAt({x, y, z})) {
-                    //int pieceIndex = (x + y + z) % 6;
-                    int pieceIndex = v[{x, y, z}];
-                    VoxelPiece properties = v.propertiesForPiece(pieceIndex);
-                    addCube((float)x, (float)y, (float)z - time, properties, vertexData);
-                }
+    std::vector<VoxelPiece> pieces;
+    for (int i = 0; i <= v.maxPieceIdx(); ++i) {
+        pieces.push_back(i == 0 || v.voxelsOfPiece(i).empty()
+            ? VoxelPiece{0, 0, Direction::XP}
+            : v.propertiesForPiece(i));
+    }
+    v.forEachVoxel([&](Pos p, int pieceIndex) {
+        // pieces move as a whole, so faces between two voxels of the same
+        // piece are never visible
+        int neighbours = v.neighbourMaskAt(p);
+        int hiddenFaces = 0;
+        for (Direction d : ALL_DIRECTIONS) {
+            if ((neighbours & (1 << d)) && v[p.nextInDirection(d)] == pieceIndex) {
+                hiddenFaces |= 1 << d;
             }
         }
-    }
+        addCube((float)p.x, (float)p.y, (float)p.z - time, pieces[pieceIndex], vertexData, hiddenFaces);
+    });
 }
 
 static const char* vertex_shader_text = R"(
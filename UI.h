@@ -1,7 +1,7 @@
 #ifndef HEADER_UI
 #define HEADER_UI
 
-class Voxels;
+#include "Voxels.h"
 
 int initGlfw(const Voxels &voxels);
 
@@ -35,7 +35,10 @@ void setColorForIndex(VoxelPiece &piece, int i) {
     }
 }
 
-VoxelPiece::VoxelPiece(int pieceIdx, int numPieces, Direction dir) {
+VoxelPiece::VoxelPiece(int pieceIdx, int numPieces, Direction dir)
+    : VoxelPiece{pieceIdx, dir, pieceIdx == 1 ? numPieces - 1 : pieceIdx - 2} {}
+
+VoxelPiece::VoxelPiece(int pieceIdx, Direction dir, int removalStep) {
     setColorForIndex(*this, pieceIdx);
     switch (dir) {
         case Direction::XP: dx = 1; dy = 0; dz = 0; break;
@@ -45,9 +48,5 @@ VoxelPiece::VoxelPiece(int pieceIdx, int numPieces, Direction dir) {
         case Direction::ZP: dx = 0; dy = 0; dz = 1; break;
         case Direction::ZN: dx = 0; dy = 0; dz = -1; break;
     }
-    if (pieceIdx == 1) {
-        movementStart = (numPieces - 1) * 15;
-    } else {
-        movementStart = (pieceIdx - 2) * 15;
-    }
+    movementStart = removalStep * 15;
 }
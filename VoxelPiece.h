@@ -8,7 +8,10 @@ struct VoxelPiece {
     float dx, dy, dz;
     float movementStart;
 
+    // Pieces are taken out in label order, with the unassigned voxels last
     VoxelPiece(int pieceIdx, int numPieces, Direction dir);
+    // removalStep is the piece's position in the order pieces are taken out
+    VoxelPiece(int pieceIdx, Direction dir, int removalStep);
 };
 
 #endif // HEADER_VOXEL_PIECE
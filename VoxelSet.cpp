@@ -0,0 +1,71 @@
+#include "VoxelSet.h"
+
+#include <cstdlib>
+#include <iostream>
+
+VoxelSet::VoxelSet(int sizeX, int sizeY, int sizeZ)
+    : sizeX{sizeX}, sizeY{sizeY}, sizeZ{sizeZ} {}
+
+long long VoxelSet::keyOf(Pos p) const {
+    // negative coordinates wrap around to large unsigned values
+    if ((unsigned)(p.x + 1) >= (unsigned)(sizeX + 2)
+        || (unsigned)(p.y + 1) >= (unsigned)(sizeY + 2)
+        || (unsigned)(p.z + 1) >= (unsigned)(sizeZ + 2)) {
+        return -1;
+    }
+    return ((long long)(p.x + 1) * (sizeY + 2) + p.y + 1) * (sizeZ + 2) + p.z + 1;
+}
+
+bool VoxelSet::contains(Pos p) const {
+    if (keys.empty()) {
+        for (const Pos &member : members) {
+            if (member == p) return true;
+        }
+        return false;
+    }
+    return keys.count(keyOf(p)) > 0;
+}
+
+bool VoxelSet::insert(Pos p) {
+    long long key = keyOf(p);
+    if (key < 0) {
+        std::cerr << "tried to add out of range position " << p << " to a voxel set" << std::endl;
+        exit(1);
+    }
+    if (contains(p)) return false;
+    members.push_back(p);
+    if (keys.empty() && members.size() > linearScanLimit) {
+        for (const Pos &member : members) {
+            keys.insert(keyOf(member));
+        }
+    } else if (!keys.empty()) {
+        keys.insert(key);
+    }
+    return true;
+}
+
+void VoxelSet::clear() {
+    // keeps the hash set's buckets for reuse
+    keys.clear();
+    members.clear();
+}
+
+size_t VoxelSet::size() const {
+    return members.size();
+}
+
+bool VoxelSet::empty() const {
+    return members.empty();
+}
+
+const std::vector<Pos> &VoxelSet::positions() const {
+    return members;
+}
+
+std::vector<Pos>::const_iterator VoxelSet::begin() const {
+    return members.begin();
+}
+
+std::vector<Pos>::const_iterator VoxelSet::end() const {
+    return members.end();
+}
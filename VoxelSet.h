@@ -0,0 +1,49 @@
+#ifndef HEADER_VOXEL_SET
+#define HEADER_VOXEL_SET
+
+#include "Pos.h"
+#include "Voxels.h"
+
+#include <unordered_set>
+#include <vector>
+
+// A set of positions in a grid with constant time membership tests. The
+// members are kept in insertion order for iteration, and membership is a
+// hash set of their keys in the grid (with the same one voxel border as
+// Voxels, so the direct neighbours of any voxel in range can be tested and
+// inserted). Small sets are scanned instead, so that short-lived sets of a
+// few voxels don't allocate anything but the member list.
+class VoxelSet {
+    static constexpr size_t linearScanLimit = 32;
+
+    int sizeX = 0;
+    int sizeY = 0;
+    int sizeZ = 0;
+    std::vector<Pos> members;
+    // keys of the members, only filled once the set outgrows linearScanLimit
+    std::unordered_set<long long> keys;
+
+    // -1 for positions outside the grid and its border
+    long long keyOf(Pos p) const;
+
+public:
+    VoxelSet(int sizeX, int sizeY, int sizeZ);
+
+    template <typename Label>
+    explicit VoxelSet(const BasicVoxels<Label> &v)
+        : VoxelSet{v.maxX(), v.maxY(), v.maxZ()} {}
+
+    bool contains(Pos p) const;
+    // Returns false if p was already a member
+    bool insert(Pos p);
+    void clear();
+
+    size_t size() const;
+    bool empty() const;
+    // Members in the order they were inserted
+    const std::vector<Pos> &positions() const;
+    std::vector<Pos>::const_iterator begin() const;
+    std::vector<Pos>::const_iterator end() const;
+};
+
+#endif // HEADER_VOXEL_SET
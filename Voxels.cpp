@@ -1,33 +1,249 @@
 #include "Voxels.h"
 #include "Direction.h"
+#include "MappedFile.h"
 #include "Pos.h"
 #include "VoxelPiece.h"
+#include "utils.h"
 
 #include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <iostream>
 #include <fstream>
+#include <limits>
+#include <memory>
 #include <sstream>
 
-Voxels::Voxels(int width, int height, int depth) : width{width}, height{height} {
-    for (int i = 0; i < width * height * depth; ++i) {
-        voxels.push_back(0);
+// x86-64 always has SSE2; other targets use the byte by byte shape scanner
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SHAPE_SCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+// Label volumes start with this header, and their data starts at
+// volumeDataOffset so that raw labels are page aligned when mapped. Numbers
+// are stored in the machine's native byte order. The magic is "VOXVOL"
+// followed by the format version and a zero byte. The data is followed by
+// `numRemovals` VolumeRemovals, and the checksum covers both. `offset` and
+// `uncroppedSize` place a cropped grid in the shape it was cut from, with a
+// size of zeros for grids that weren't cropped.
+struct VolumeHeader {
+    char magic[8];
+    uint32_t labelBytes;
+    uint32_t layout;
+    int32_t width;
+    int32_t height;
+    int32_t depth;
+    uint32_t encoding;
+    uint64_t dataBytes;
+    uint64_t checksum;
+    uint32_t numRemovals;
+    int32_t offset[3];
+    int32_t uncroppedSize[3];
+};
+
+static const char volumeMagic[6] = {'V', 'O', 'X', 'V', 'O', 'L'};
+static constexpr char volumeVersion = '1';
+static constexpr size_t volumeDataOffset = 4096;
+
+// Checksum of a volume's data, fed in pieces of any size. It mixes in a
+// word at a time, so checking it keeps up with reading the file.
+class VolumeChecksum {
+    uint64_t hash = 0xcbf29ce484222325;
+    uint64_t partial = 0;
+    int partialBytes = 0;
+
+    void addWord(uint64_t word) {
+        hash = (hash ^ word) * 0x100000001b3;
+        hash ^= hash >> 29;
+    }
+
+public:
+    void add(const char *data, size_t size) {
+        while (size > 0 && partialBytes > 0) {
+            partial |= (uint64_t)(unsigned char)*data++ << (partialBytes * 8);
+            --size;
+            if (++partialBytes == 8) {
+                addWord(partial);
+                partial = 0;
+                partialBytes = 0;
+            }
+        }
+        for (; size >= 8; data += 8, size -= 8) {
+            uint64_t word;
+            memcpy(&word, data, 8);
+            addWord(word);
+        }
+        if (size > 0) {
+            for (size_t i = 0; i < size; ++i) {
+                partial |= (uint64_t)(unsigned char)data[i] << (i * 8);
+            }
+            partialBytes = (int)size;
+        }
     }
+
+    uint64_t value() const {
+        VolumeChecksum copy = *this;
+        if (copy.partialBytes > 0) copy.addWord(copy.partial);
+        return copy.hash;
+    }
+};
+
+// A run of `length` voxels with the same label, in x, y, z order
+struct VolumeRun {
+    uint32_t length;
+    uint32_t label;
+};
+
+// A step of a finished puzzle's removal order
+struct VolumeRemoval {
+    uint32_t piece;
+    uint32_t direction;
+};
+
+template <typename Label>
+BasicVoxels<Label>::LabelRef::LabelRef(BasicVoxels &voxels, Pos pos) : voxels{voxels}, pos{pos} {}
+
+template <typename Label>
+BasicVoxels<Label>::LabelRef::operator int() const {
+    return static_cast<const BasicVoxels &>(voxels)[pos];
 }
 
-Voxels Voxels::readFile(const std::string &filename) {
-    std::ifstream fin{filename};
-    if (!fin) {
-        std::cerr << "Failed to open file " << filename << ": " << strerror(errno) << std::endl;
+template <typename Label>
+typename BasicVoxels<Label>::LabelRef &BasicVoxels<Label>::LabelRef::operator=(int label) {
+    if (label < 0 || label > maxLabel()) {
+        std::cerr << "label " << label << " at " << pos << " doesn't fit into "
+            << sizeof(Label) * 8 << " bits" << std::endl;
+        exit(1);
+    }
+    voxels.set(pos, label);
+    return *this;
+}
+
+template <typename Label>
+typename BasicVoxels<Label>::LabelRef &BasicVoxels<Label>::LabelRef::operator=(const LabelRef &other) {
+    return *this = static_cast<int>(other);
+}
+
+template <typename Label>
+BasicVoxels<Label>::BasicVoxels(int width, int height, int depth, VoxelLayout layout)
+    : BasicVoxels{width, height, depth, layout, LabelStorage<Label>{}} {}
+
+template <typename Label>
+BasicVoxels<Label>::BasicVoxels(int width, int height, int depth, VoxelLayout layout, LabelStorage<Label> storage)
+    : width{width}, height{height}, depth{depth}, layout{layout}, voxels{std::move(storage)},
+    labelCounts(maxLabel() + 1),
+    occupied{depth, height, width}, piecePlanes{BitGrid{}, BitGrid{depth, height, width}},
+    rayTables{depth, height, width} {
+    if (layout == VoxelLayout::Linear) {
+        strideY = width + 2;
+        strideX = (height + 2) * strideY;
+        origin = strideX + strideY + 1;
+        offsets[Direction::XP] = strideX;
+        offsets[Direction::XN] = -strideX;
+        offsets[Direction::YP] = strideY;
+        offsets[Direction::YN] = -strideY;
+        offsets[Direction::ZP] = 1;
+        offsets[Direction::ZN] = -1;
+        allocateStorage((size_t)(depth + 2) * strideX);
+        return;
+    }
+    int bricksX = (depth + 2 + 3) / 4;
+    bricksY = (height + 2 + 3) / 4;
+    bricksZ = (width + 2 + 3) / 4;
+    for (Direction d : ALL_DIRECTIONS) {
+        int inBrickStep = 1 << brickShifts[d];
+        int brickStep = 64;
+        if (d == Direction::XP || d == Direction::XN) brickStep *= bricksY * bricksZ;
+        if (d == Direction::YP || d == Direction::YN) brickStep *= bricksZ;
+        // leaving a brick lands on the opposite face of the next one
+        if (brickFaces[d] == 3) {
+            offsets[d] = inBrickStep;
+            brickExits[d] = brickStep - 3 * inBrickStep;
+        } else {
+            offsets[d] = -inBrickStep;
+            brickExits[d] = 3 * inBrickStep - brickStep;
+        }
+    }
+    if (layout == VoxelLayout::Sparse) {
+        brickSlots.resize((size_t)bricksX * bricksY * bricksZ, -1);
+    } else {
+        allocateStorage((size_t)bricksX * bricksY * bricksZ * 64);
+    }
+}
+
+template <typename Label>
+BasicVoxels<Label>::BasicVoxels(const BasicVoxels &other)
+    : width{other.width}, height{other.height}, depth{other.depth}, layout{other.layout},
+    cropOffset{other.cropOffset}, cropSize{other.cropSize},
+    voxels{other.voxels}, origin{other.origin}, strideX{other.strideX}, strideY{other.strideY},
+    bricksY{other.bricksY}, bricksZ{other.bricksZ}, brickSlots{other.brickSlots},
+    voxelCount{other.voxelCount}, zobristHash{other.zobristHash},
+    labelCounts{other.labelCounts}, maxLabelInUse{other.maxLabelInUse},
+    offsets{other.offsets}, brickExits{other.brickExits},
+    occupied{other.occupied}, piecePlanes{other.piecePlanes},
+    rayTables{other.depth, other.height, other.width}, removals{other.removals},
+    journal{other.journal}, openCheckpoints{other.openCheckpoints} {}
+
+template <typename Label>
+BasicVoxels<Label> &BasicVoxels<Label>::operator=(const BasicVoxels &other) {
+    return *this = BasicVoxels{other};
+}
+
+template <typename Label>
+void BasicVoxels<Label>::allocateStorage(size_t size) {
+    if (!voxels.isMapped()) {
+        voxels.resize(size);
+        return;
+    }
+    if (voxels.size() != size) {
+        std::cerr << "Volume has " << voxels.size() << " labels, expected "
+            << size << " for a " << width << "x" << height << "x" << depth << " grid" << std::endl;
         exit(1);
     }
-    std::string line;
-    if (!std::getline(fin, line)) {
+}
+
+template <typename Label>
+int BasicVoxels<Label>::maxLabel() {
+    return std::numeric_limits<Label>::max();
+}
+
+// The characters operator>> skips between voxels
+static bool isShapeSpace(char ch) {
+    return ch == ' ' || (ch >= '\t' && ch <= '\r');
+}
+
+#ifdef SHAPE_SCAN_SSE2
+// Classifies the 16 bytes at s: bit i of the results is set if s[i] is a
+// voxel ('.' or 'x'), an 'x', or whitespace
+static void classifyShapeBytes(const char *s, unsigned &voxelBits, unsigned &xBits, unsigned &spaceBits) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+    __m128i x = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('x'));
+    __m128i dot = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('.'));
+    // '\t' to '\r', compared as signed bytes, so bytes above 127 never match
+    __m128i control = _mm_and_si128(
+        _mm_cmpgt_epi8(bytes, _mm_set1_epi8('\t' - 1)),
+        _mm_cmplt_epi8(bytes, _mm_set1_epi8('\r' + 1)));
+    __m128i space = _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')), control);
+    xBits = (unsigned)_mm_movemask_epi8(x);
+    voxelBits = (unsigned)_mm_movemask_epi8(_mm_or_si128(x, dot));
+    spaceBits = (unsigned)_mm_movemask_epi8(space);
+}
+#endif
+
+template <typename Label>
+BasicVoxels<Label> BasicVoxels<Label>::readFile(const std::string &filename, VoxelLayout layout) {
+    // one pass over the mapped file, instead of a stream per line
+    MappedFile file{filename};
+    const char *pos = file.data();
+    const char *end = pos + file.size();
+    if (pos == end) {
         std::cerr << "Failed to read shape dimensions" << std::endl;
         exit(1);
     }
-    std::stringstream strstream{line};
+    const char *lineEnd = std::find(pos, end, '\n');
+    std::stringstream strstream{std::string{pos, lineEnd}};
+    pos = lineEnd == end ? end : lineEnd + 1;
     int width = 0, height = 0, depth = 0;
     strstream >> width;
     strstream >> height;
@@ -36,140 +252,916 @@ Voxels Voxels::readFile(const std::string &filename) {
         std::cerr << "Width, height and depth must all be greater than 0" << std::endl;
         exit(1);
     }
-    Voxels result{width, height, depth};
+    BasicVoxels result{width, height, depth, layout};
     int voxelIdx = 0;
-    while (std::getline(fin, line)) {
-        strstream = std::stringstream{line};
-        char ch = '\0';
-        while (strstream >> ch) {
-            if ((size_t)voxelIdx >= result.voxels.size()) {
-                std::cerr << "Too many voxels: expected "
-                    << (width * height * depth) << std::endl;
+    int numVoxels = width * height * depth;
+    auto setVoxel = [&](int idx) {
+        result.set({idx / (width * height), idx / width % height, idx % width}, 1);
+    };
+    while (pos != end) {
+#ifdef SHAPE_SCAN_SSE2
+        // Blocks of 16 bytes that only hold voxels and whitespace, and don't
+        // run past the last voxel, are handled at once. Anything else goes
+        // through the byte by byte loop, which reports the error.
+        if (end - pos >= 16) {
+            unsigned voxelBits, xBits, spaceBits;
+            classifyShapeBytes(pos, voxelBits, xBits, spaceBits);
+            int voxelsInBlock = popcount(voxelBits);
+            if ((voxelBits | spaceBits) == 0xffff && voxelIdx + voxelsInBlock <= numVoxels) {
+                while (xBits != 0) {
+                    int bit = countTrailingZeros(xBits);
+                    setVoxel(voxelIdx + popcount(voxelBits & ((1u << bit) - 1)));
+                    xBits &= xBits - 1;
+                }
+                voxelIdx += voxelsInBlock;
+                pos += 16;
+                continue;
+            }
+        }
+#endif
+        char ch = *pos++;
+        if (isShapeSpace(ch)) continue;
+        if (voxelIdx >= numVoxels) {
+            std::cerr << "Too many voxels: expected " << numVoxels << std::endl;
+            exit(1);
+        }
+        // a count in front of a voxel repeats it, so "12x" is 12 'x's
+        int runLength = 1;
+        if (ch >= '0' && ch <= '9') {
+            // capped so that long runs of digits can't overflow
+            long long count = ch - '0';
+            while (pos != end && *pos >= '0' && *pos <= '9') {
+                count = std::min<long long>(count * 10 + (*pos++ - '0'), (long long)numVoxels + 1);
+            }
+            if (pos == end) {
+                std::cerr << "Run length at voxel index " << voxelIdx
+                    << " isn't followed by a voxel" << std::endl;
                 exit(1);
             }
-            switch (ch) {
-                case '.':
-                    result.voxels[voxelIdx++] = 0;
-                    break;
-                case 'x':
-                    result.voxels[voxelIdx++] = 1;
-                    break;
-                default:
-                    std::cerr << "Unexpected character at voxel index "
-                        << voxelIdx << ": '" << ch << "'" << std::endl;
-                    exit(1);
+            if (count == 0) {
+                std::cerr << "Run length at voxel index " << voxelIdx
+                    << " must be greater than 0" << std::endl;
+                exit(1);
+            }
+            if (count > numVoxels - voxelIdx) {
+                std::cerr << "Too many voxels: expected " << numVoxels << std::endl;
+                exit(1);
             }
+            runLength = (int)count;
+            ch = *pos++;
+        }
+        switch (ch) {
+            case '.':
+                voxelIdx += runLength;
+                break;
+            case 'x':
+                for (int i = 0; i < runLength; ++i) {
+                    setVoxel(voxelIdx + i);
+                }
+                voxelIdx += runLength;
+                break;
+            default:
+                std::cerr << "Unexpected character at voxel index "
+                    << voxelIdx << ": '" << ch << "'" << std::endl;
+                exit(1);
         }
     }
-    if (voxelIdx < width * height * depth) {
-        std::cerr << "Expected " << (width * height * depth) << " voxels, "
+    if (voxelIdx < numVoxels) {
+        std::cerr << "Expected " << numVoxels << " voxels, "
             << "found " << voxelIdx << std::endl;
         exit(1);
     }
+    result.cropToContents();
+    return result;
+}
+
+template <typename Label>
+BasicVoxels<Label> BasicVoxels<Label>::mapVolume(const std::string &filename) {
+    auto file = std::make_shared<MappedFile>(filename);
+    VolumeHeader header;
+    if (file->size() < volumeDataOffset) {
+        std::cerr << filename << " is too short to be a label volume" << std::endl;
+        exit(1);
+    }
+    memcpy(&header, file->data(), sizeof(header));
+    if (memcmp(header.magic, volumeMagic, sizeof(volumeMagic)) != 0 || header.magic[7] != '\0') {
+        std::cerr << filename << " is not a label volume" << std::endl;
+        exit(1);
+    }
+    if (header.magic[6] != volumeVersion) {
+        std::cerr << filename << " is a version " << header.magic[6] << " label volume, only version "
+            << volumeVersion << " can be read" << std::endl;
+        exit(1);
+    }
+    if (header.labelBytes != sizeof(Label)) {
+        std::cerr << "Volume has " << header.labelBytes * 8 << " bit labels, expected "
+            << sizeof(Label) * 8 << std::endl;
+        exit(1);
+    }
+    VolumeEncoding encoding = (VolumeEncoding)header.encoding;
+    // raw labels are used in place, so they must be in a layout that
+    // stores every voxel
+    bool rawLayout = header.layout == (uint32_t)VoxelLayout::Linear || header.layout == (uint32_t)VoxelLayout::Bricked;
+    if (!rawLayout && !(header.layout == (uint32_t)VoxelLayout::Sparse && encoding != VolumeEncoding::Raw)) {
+        std::cerr << "Unknown volume layout " << header.layout << std::endl;
+        exit(1);
+    }
+    if (header.width <= 0 || header.height <= 0 || header.depth <= 0) {
+        std::cerr << "Width, height and depth must all be greater than 0" << std::endl;
+        exit(1);
+    }
+    Pos offset{header.offset[0], header.offset[1], header.offset[2]};
+    Pos uncroppedSize{header.uncroppedSize[0], header.uncroppedSize[1], header.uncroppedSize[2]};
+    bool isCropped = !(uncroppedSize == Pos{0, 0, 0});
+    if (isCropped && (offset.x < 0 || offset.y < 0 || offset.z < 0
+            || offset.x + header.depth > uncroppedSize.x || offset.y + header.height > uncroppedSize.y
+            || offset.z + header.width > uncroppedSize.z)) {
+        std::cerr << "Volume's grid at offset " << offset << " doesn't fit into the "
+            << uncroppedSize.z << "x" << uncroppedSize.y << "x" << uncroppedSize.x
+            << " shape it was cropped from" << std::endl;
+        exit(1);
+    }
+    if (header.dataBytes > file->size() - volumeDataOffset) {
+        std::cerr << filename << " is truncated: expected " << header.dataBytes << " bytes of data, found "
+            << file->size() - volumeDataOffset << std::endl;
+        exit(1);
+    }
+    size_t removalBytes = (size_t)header.numRemovals * sizeof(VolumeRemoval);
+    if (removalBytes > file->size() - volumeDataOffset - header.dataBytes) {
+        std::cerr << filename << " is truncated: expected " << header.numRemovals
+            << " removal steps after its data" << std::endl;
+        exit(1);
+    }
+    const char *data = file->data() + volumeDataOffset;
+    VolumeChecksum checksum;
+    checksum.add(data, header.dataBytes + removalBytes);
+    if (checksum.value() != header.checksum) {
+        std::cerr << filename << " is corrupt: its checksum doesn't match" << std::endl;
+        exit(1);
+    }
+    std::vector<PieceRemoval> removals;
+    for (uint32_t i = 0; i < header.numRemovals; ++i) {
+        VolumeRemoval removal;
+        memcpy(&removal, data + header.dataBytes + i * sizeof(removal), sizeof(removal));
+        if (removal.piece < 2 || removal.piece > (uint32_t)maxLabel() || removal.direction > Direction::ZN) {
+            std::cerr << "Volume has an invalid removal step: piece " << removal.piece
+                << " in direction " << removal.direction << std::endl;
+            exit(1);
+        }
+        removals.push_back({(int)removal.piece, (Direction::Value)removal.direction});
+    }
+    auto restoreMetadata = [&](BasicVoxels &result) {
+        result.removals = std::move(removals);
+        if (isCropped) {
+            result.cropOffset = offset;
+            result.cropSize = uncroppedSize;
+        }
+    };
+    VoxelLayout layout = (VoxelLayout)header.layout;
+    int width = header.width, height = header.height;
+    size_t numVoxels = (size_t)width * height * header.depth;
+    auto posOf = [&](size_t idx) {
+        return Pos{(int)(idx / ((size_t)width * height)), (int)(idx / width % height), (int)(idx % width)};
+    };
+    switch (encoding) {
+        case VolumeEncoding::Raw: {
+            BasicVoxels result{width, height, header.depth, layout,
+                LabelStorage<Label>{file, volumeDataOffset, header.dataBytes / sizeof(Label)}};
+            result.scanStorage();
+            restoreMetadata(result);
+            return result;
+        }
+        case VolumeEncoding::Occupancy: {
+            size_t numWords = (numVoxels + 63) / 64;
+            if (header.dataBytes != numWords * 8) {
+                std::cerr << "Volume has " << header.dataBytes << " bytes of occupancy bits, expected "
+                    << numWords * 8 << std::endl;
+                exit(1);
+            }
+            BasicVoxels result{width, height, header.depth, layout};
+            for (size_t i = 0; i < numWords; ++i) {
+                uint64_t word;
+                memcpy(&word, data + i * 8, 8);
+                while (word != 0) {
+                    size_t idx = i * 64 + countTrailingZeros(word);
+                    if (idx >= numVoxels) {
+                        std::cerr << "Volume has occupancy bits past its last voxel" << std::endl;
+                        exit(1);
+                    }
+                    result.set(posOf(idx), 1);
+                    word &= word - 1;
+                }
+            }
+            restoreMetadata(result);
+            return result;
+        }
+        case VolumeEncoding::RunLength: {
+            if (header.dataBytes % sizeof(VolumeRun) != 0) {
+                std::cerr << "Volume's run data isn't a whole number of runs" << std::endl;
+                exit(1);
+            }
+            BasicVoxels result{width, height, header.depth, layout};
+            size_t idx = 0;
+            for (size_t offset = 0; offset < header.dataBytes; offset += sizeof(VolumeRun)) {
+                VolumeRun run;
+                memcpy(&run, data + offset, sizeof(run));
+                if (run.length > numVoxels - idx) {
+                    std::cerr << "Volume has runs past its last voxel" << std::endl;
+                    exit(1);
+                }
+                if (run.label > (uint32_t)maxLabel()) {
+                    std::cerr << "Volume has label " << run.label << ", which doesn't fit into "
+                        << sizeof(Label) * 8 << " bits" << std::endl;
+                    exit(1);
+                }
+                if (run.label != 0) {
+                    for (size_t i = idx; i < idx + run.length; ++i) {
+                        result.set(posOf(i), run.label);
+                    }
+                }
+                idx += run.length;
+            }
+            if (idx != numVoxels) {
+                std::cerr << "Volume's runs cover " << idx << " voxels, expected " << numVoxels << std::endl;
+                exit(1);
+            }
+            restoreMetadata(result);
+            return result;
+        }
+    }
+    std::cerr << "Unknown volume encoding " << header.encoding << std::endl;
+    exit(1);
+}
+
+template <typename Label>
+void BasicVoxels<Label>::writeVolume(const std::string &filename, VolumeEncoding encoding) const {
+    std::ofstream fout{filename, std::ios::binary};
+    if (!fout) {
+        std::cerr << "Failed to open file " << filename << ": " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    VolumeHeader header{};
+    memcpy(header.magic, volumeMagic, sizeof(volumeMagic));
+    header.magic[6] = volumeVersion;
+    header.magic[7] = '\0';
+    header.labelBytes = sizeof(Label);
+    // raw sparse grids are written out in full, so they're read as bricked
+    bool sparseAsBricked = layout == VoxelLayout::Sparse && encoding == VolumeEncoding::Raw;
+    header.layout = (uint32_t)(sparseAsBricked ? VoxelLayout::Bricked : layout);
+    header.width = width;
+    header.height = height;
+    header.depth = depth;
+    header.encoding = (uint32_t)encoding;
+    header.dataBytes = 0;
+    header.numRemovals = (uint32_t)removals.size();
+    header.offset[0] = cropOffset.x;
+    header.offset[1] = cropOffset.y;
+    header.offset[2] = cropOffset.z;
+    header.uncroppedSize[0] = cropSize.x;
+    header.uncroppedSize[1] = cropSize.y;
+    header.uncroppedSize[2] = cropSize.z;
+    // the header is written again with the checksum once the data is out
+    std::vector<char> padded(volumeDataOffset);
+    fout.write(padded.data(), padded.size());
+    VolumeChecksum checksum;
+    auto writeData = [&](const void *data, size_t size) {
+        fout.write(static_cast<const char *>(data), size);
+        checksum.add(static_cast<const char *>(data), size);
+        header.dataBytes += size;
+    };
+    size_t numVoxels = (size_t)width * height * depth;
+    auto indexOfVoxel = [&](Pos p) {
+        return ((size_t)p.x * height + p.y) * width + p.z;
+    };
+    switch (encoding) {
+        case VolumeEncoding::Raw:
+            if (layout == VoxelLayout::Sparse) {
+                // unallocated bricks are written out as empty ones
+                std::vector<Label> brick(64);
+                for (int slot : brickSlots) {
+                    for (int i = 0; i < 64; ++i) {
+                        brick[i] = slot < 0 ? 0 : voxels[slot + i];
+                    }
+                    writeData(brick.data(), 64 * sizeof(Label));
+                }
+            } else {
+                voxels.forEachChunk([&](const Label *labels, size_t count) {
+                    writeData(labels, count * sizeof(Label));
+                });
+            }
+            break;
+        case VolumeEncoding::Occupancy: {
+            if (maxLabelInUse > 1) {
+                std::cerr << "Only grids without pieces can be written as occupancy bits" << std::endl;
+                exit(1);
+            }
+            std::vector<uint64_t> words((numVoxels + 63) / 64);
+            forEachVoxel([&](Pos p, int) {
+                size_t idx = indexOfVoxel(p);
+                words[idx >> 6] |= uint64_t{1} << (idx & 63);
+            });
+            writeData(words.data(), words.size() * 8);
+            break;
+        }
+        case VolumeEncoding::RunLength: {
+            std::vector<VolumeRun> runs;
+            auto addRun = [&](size_t length, int label) {
+                // runs longer than 32 bits are split
+                while (length > 0) {
+                    uint32_t part = (uint32_t)std::min<size_t>(length, UINT32_MAX);
+                    if (!runs.empty() && runs.back().label == (uint32_t)label && runs.back().length <= UINT32_MAX - part) {
+                        runs.back().length += part;
+                    } else {
+                        runs.push_back({part, (uint32_t)label});
+                    }
+                    length -= part;
+                }
+            };
+            size_t next = 0;
+            forEachVoxel([&](Pos p, int label) {
+                size_t idx = indexOfVoxel(p);
+                addRun(idx - next, 0);
+                addRun(1, label);
+                next = idx + 1;
+            });
+            addRun(numVoxels - next, 0);
+            writeData(runs.data(), runs.size() * sizeof(VolumeRun));
+            break;
+        }
+    }
+    for (const PieceRemoval &removal : removals) {
+        VolumeRemoval step{(uint32_t)removal.piece, (uint32_t)(Direction::Value)removal.dir};
+        fout.write(reinterpret_cast<const char *>(&step), sizeof(step));
+        checksum.add(reinterpret_cast<const char *>(&step), sizeof(step));
+    }
+    header.checksum = checksum.value();
+    memcpy(padded.data(), &header, sizeof(header));
+    fout.seekp(0);
+    fout.write(padded.data(), sizeof(header));
+    if (!fout) {
+        std::cerr << "Failed to write file " << filename << ": " << strerror(errno) << std::endl;
+        exit(1);
+    }
+}
+
+template <typename Label>
+void BasicVoxels<Label>::writeFile(const std::string &filename, bool runLength) const {
+    std::ofstream fout{filename};
+    if (!fout) {
+        std::cerr << "Failed to open file " << filename << ": " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    // cropped margins are written back as empty voxels
+    Pos size = uncroppedSize();
+    fout << size.z << " " << size.y << " " << size.x << "\n";
+    std::string line(size.z, '.');
+    for (int x = 0; x < size.x; ++x) {
+        fout << "\n";
+        for (int y = 0; y < size.y; ++y) {
+            for (int z = 0; z < size.z; ++z) {
+                line[z] = existsAt({x - cropOffset.x, y - cropOffset.y, z - cropOffset.z}) ? 'x' : '.';
+            }
+            if (!runLength) {
+                fout << line << "\n";
+                continue;
+            }
+            // runs of three or more are shorter with a count, runs don't
+            // cross rows so that the file keeps its shape
+            for (int z = 0; z < size.z;) {
+                int end = z + 1;
+                while (end < size.z && line[end] == line[z]) ++end;
+                if (end - z >= 3) {
+                    fout << end - z << line[z];
+                } else {
+                    fout << line.substr(z, end - z);
+                }
+                z = end;
+            }
+            fout << "\n";
+        }
+    }
+    if (!fout) {
+        std::cerr << "Failed to write file " << filename << ": " << strerror(errno) << std::endl;
+        exit(1);
+    }
+}
+
+// MagicaVoxel files are a "VOX " header and a version, then a MAIN chunk
+// whose children hold the models and palette. Every chunk starts with its
+// id and the sizes of its content and of its children, little-endian.
+struct VoxChunkHeader {
+    char id[4];
+    uint32_t contentBytes;
+    uint32_t childrenBytes;
+};
+
+static uint32_t readVoxWord(const unsigned char *bytes) {
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static void writeVoxWord(std::ostream &out, uint32_t word) {
+    char bytes[4] = {(char)word, (char)(word >> 8), (char)(word >> 16), (char)(word >> 24)};
+    out.write(bytes, 4);
+}
+
+static void writeVoxChunkHeader(std::ostream &out, const char *id, uint32_t contentBytes, uint32_t childrenBytes) {
+    out.write(id, 4);
+    writeVoxWord(out, contentBytes);
+    writeVoxWord(out, childrenBytes);
+}
+
+// MagicaVoxel's z axis points up, like y in the viewer, so a voxel at
+// {x, y, z} is stored at (x, width - 1 - z, y) to keep the shape unmirrored.
+template <typename Label>
+BasicVoxels<Label> BasicVoxels<Label>::readVox(const std::string &filename, VoxelLayout layout) {
+    std::ifstream fin{filename, std::ios::binary};
+    if (!fin) {
+        std::cerr << "Failed to open file " << filename << ": " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    unsigned char bytes[12];
+    if (!fin.read(reinterpret_cast<char *>(bytes), 8) || memcmp(bytes, "VOX ", 4) != 0) {
+        std::cerr << filename << " is not a MagicaVoxel file" << std::endl;
+        exit(1);
+    }
+    auto readChunkHeader = [&](VoxChunkHeader &chunk) {
+        if (!fin.read(reinterpret_cast<char *>(bytes), 12)) return false;
+        memcpy(chunk.id, bytes, 4);
+        chunk.contentBytes = readVoxWord(bytes + 4);
+        chunk.childrenBytes = readVoxWord(bytes + 8);
+        return true;
+    };
+    VoxChunkHeader chunk;
+    if (!readChunkHeader(chunk) || memcmp(chunk.id, "MAIN", 4) != 0) {
+        std::cerr << filename << " has no MAIN chunk" << std::endl;
+        exit(1);
+    }
+    fin.seekg(chunk.contentBytes, std::ios::cur);
+    // Models are a SIZE chunk followed by an XYZI chunk. Only the first one
+    // is read, the others would need the scene graph to be placed.
+    std::vector<BasicVoxels> models;
+    int numModels = 0;
+    bool haveVoxels = false;
+    int width = 0, height = 0, depth = 0;
+    while (readChunkHeader(chunk)) {
+        std::streamoff next = (std::streamoff)fin.tellg() + chunk.contentBytes + chunk.childrenBytes;
+        if (memcmp(chunk.id, "SIZE", 4) == 0 && ++numModels == 1) {
+            if (chunk.contentBytes < 12 || !fin.read(reinterpret_cast<char *>(bytes), 12)) {
+                std::cerr << filename << " has a truncated SIZE chunk" << std::endl;
+                exit(1);
+            }
+            depth = (int)readVoxWord(bytes);
+            width = (int)readVoxWord(bytes + 4);
+            height = (int)readVoxWord(bytes + 8);
+            if (width <= 0 || height <= 0 || depth <= 0) {
+                std::cerr << "Width, height and depth must all be greater than 0" << std::endl;
+                exit(1);
+            }
+            models.emplace_back(width, height, depth, layout);
+        } else if (memcmp(chunk.id, "XYZI", 4) == 0 && numModels == 1 && !haveVoxels) {
+            BasicVoxels &result = models.back();
+            if (!fin.read(reinterpret_cast<char *>(bytes), 4)) {
+                std::cerr << filename << " has a truncated XYZI chunk" << std::endl;
+                exit(1);
+            }
+            uint32_t numVoxels = readVoxWord(bytes);
+            if (chunk.contentBytes < 4 + (uint64_t)numVoxels * 4) {
+                std::cerr << filename << " has a truncated XYZI chunk" << std::endl;
+                exit(1);
+            }
+            // voxels are read a block at a time, so the file is never
+            // held in memory
+            std::vector<unsigned char> block;
+            for (uint32_t done = 0; done < numVoxels;) {
+                uint32_t count = std::min<uint32_t>(numVoxels - done, 4096);
+                block.resize((size_t)count * 4);
+                if (!fin.read(reinterpret_cast<char *>(block.data()), block.size())) {
+                    std::cerr << filename << " has a truncated XYZI chunk" << std::endl;
+                    exit(1);
+                }
+                for (uint32_t i = 0; i < count; ++i) {
+                    const unsigned char *voxel = &block[i * 4];
+                    Pos p{voxel[0], voxel[2], width - 1 - voxel[1]};
+                    if (!result.isInRange(p)) {
+                        std::cerr << "Voxel (" << (int)voxel[0] << ", " << (int)voxel[1] << ", "
+                            << (int)voxel[2] << ") is outside the " << depth << "x" << width << "x"
+                            << height << " model" << std::endl;
+                        exit(1);
+                    }
+                    // colour index 0 is empty in MagicaVoxel
+                    if (voxel[3] != 0) {
+                        result[p] = voxel[3];
+                    }
+                }
+                done += count;
+            }
+            haveVoxels = true;
+        }
+        fin.clear();
+        fin.seekg(next);
+    }
+    if (models.empty()) {
+        std::cerr << filename << " has no models" << std::endl;
+        exit(1);
+    }
+    if (numModels > 1) {
+        std::cerr << "Only the first of " << numModels << " models in " << filename
+            << " is read" << std::endl;
+    }
+    BasicVoxels result = std::move(models.back());
+    result.cropToContents();
     return result;
 }
 
-int Voxels::maxX() const {
-    return voxels.size() / width / height;
+template <typename Label>
+void BasicVoxels<Label>::writeVox(const std::string &filename) const {
+    // cropped margins are put back, so the model has the original size
+    Pos size = uncroppedSize();
+    if (size.z > 256 || size.y > 256 || size.x > 256) {
+        std::cerr << "MagicaVoxel models can't be larger than 256x256x256, this grid is "
+            << size.z << "x" << size.y << "x" << size.x << std::endl;
+        exit(1);
+    }
+    if (maxPieceIdx() > 255) {
+        std::cerr << "MagicaVoxel palettes only have room for 255 pieces" << std::endl;
+        exit(1);
+    }
+    std::ofstream fout{filename, std::ios::binary};
+    if (!fout) {
+        std::cerr << "Failed to open file " << filename << ": " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    uint32_t numVoxels = voxelCount;
+    uint32_t sizeBytes = 12 + 12;
+    uint32_t xyziBytes = 12 + 4 + numVoxels * 4;
+    uint32_t rgbaBytes = 12 + 256 * 4;
+    fout.write("VOX ", 4);
+    writeVoxWord(fout, 150);
+    writeVoxChunkHeader(fout, "MAIN", 0, sizeBytes + xyziBytes + rgbaBytes);
+    writeVoxChunkHeader(fout, "SIZE", 12, 0);
+    writeVoxWord(fout, size.x);
+    writeVoxWord(fout, size.z);
+    writeVoxWord(fout, size.y);
+    writeVoxChunkHeader(fout, "XYZI", 4 + numVoxels * 4, 0);
+    writeVoxWord(fout, numVoxels);
+    std::vector<char> block;
+    block.reserve(4096 * 4);
+    forEachVoxel([&](Pos p, int label) {
+        int x = p.x + cropOffset.x, y = p.y + cropOffset.y, z = p.z + cropOffset.z;
+        block.insert(block.end(), {(char)x, (char)(size.z - 1 - z), (char)y, (char)label});
+        if (block.size() == block.capacity()) {
+            fout.write(block.data(), block.size());
+            block.clear();
+        }
+    });
+    fout.write(block.data(), block.size());
+    // entry i of the palette is colour index i + 1, each piece gets the
+    // colour the viewer draws it in
+    writeVoxChunkHeader(fout, "RGBA", 256 * 4, 0);
+    for (int index = 1; index <= 256; ++index) {
+        unsigned char rgba[4] = {128, 128, 128, 255};
+        if (index <= maxPieceIdx()) {
+            VoxelPiece piece{index, maxPieceIdx(), Direction::XP};
+            rgba[0] = (unsigned char)(piece.r * 255);
+            rgba[1] = (unsigned char)(piece.g * 255);
+            rgba[2] = (unsigned char)(piece.b * 255);
+        }
+        fout.write(reinterpret_cast<const char *>(rgba), 4);
+    }
+    if (!fout) {
+        std::cerr << "Failed to write file " << filename << ": " << strerror(errno) << std::endl;
+        exit(1);
+    }
+}
+
+template <typename Label>
+bool BasicVoxels<Label>::isMapped() const {
+    return voxels.isMapped();
+}
+
+template <typename Label>
+void BasicVoxels<Label>::scanStorage() {
+    bool dirtyBorder = false;
+    // index is the storage index of {x - 1, y - 1, z - 1}, which keeps
+    // increasing by one through either layout
+    auto visit = [&](int index, int x, int y, int z) {
+        int label = voxels[index];
+        if (label == 0) return;
+        Pos p{x - 1, y - 1, z - 1};
+        if (!isInRange(p)) {
+            dirtyBorder = true;
+            return;
+        }
+        ++voxelCount;
+        zobristHash ^= zobristKey(p, label);
+        ++labelCounts[label];
+        maxLabelInUse = std::max(maxLabelInUse, label);
+        occupied.set(p, true);
+        if (label >= (int)piecePlanes.size()) {
+            piecePlanes.resize(label + 1, BitGrid{depth, height, width});
+        }
+        piecePlanes[label].set(p, true);
+    };
+    int index = 0;
+    if (layout == VoxelLayout::Linear) {
+        for (int x = 0; x < depth + 2; ++x) {
+            for (int y = 0; y < height + 2; ++y) {
+                for (int z = 0; z < width + 2; ++z) {
+                    visit(index++, x, y, z);
+                }
+            }
+        }
+    } else {
+        int bricksX = (depth + 2 + 3) / 4;
+        for (int bx = 0; bx < bricksX; ++bx) {
+            for (int by = 0; by < bricksY; ++by) {
+                for (int bz = 0; bz < bricksZ; ++bz) {
+                    for (int i = 0; i < 64; ++i) {
+                        visit(index++, bx * 4 + (i >> 4), by * 4 + ((i >> 2) & 3), bz * 4 + (i & 3));
+                    }
+                }
+            }
+        }
+    }
+    if (dirtyBorder) {
+        std::cerr << "Volume has labels outside of its " << width << "x" << height << "x"
+            << depth << " grid" << std::endl;
+        exit(1);
+    }
+}
+
+template <typename Label>
+int BasicVoxels<Label>::maxX() const {
+    return depth;
 }
 
-int Voxels::maxY() const {
+template <typename Label>
+int BasicVoxels<Label>::maxY() const {
     return height;
 }
 
-int Voxels::maxZ() const {
+template <typename Label>
+int BasicVoxels<Label>::maxZ() const {
     return width;
 }
 
-bool Voxels::isInRange(Pos p) const {
-    if (p.x < 0 || p.y < 0 || p.z < 0) return false;
-    if (p.x >= maxX() || p.y >= maxY() || p.z >= maxZ()) return false;
-    return true;
+template <typename Label>
+VoxelLayout BasicVoxels<Label>::storageLayout() const {
+    return layout;
+}
+
+template <typename Label>
+Pos BasicVoxels<Label>::offset() const {
+    return cropOffset;
+}
+
+template <typename Label>
+Pos BasicVoxels<Label>::uncroppedSize() const {
+    return cropSize == Pos{0, 0, 0} ? Pos{depth, height, width} : cropSize;
+}
+
+template <typename Label>
+void BasicVoxels<Label>::cropToContents() {
+    if (openCheckpoints > 0) {
+        std::cerr << "Can't crop a grid with open checkpoints" << std::endl;
+        exit(1);
+    }
+    Pos min{0, 0, 0}, max{0, 0, 0};
+    if (!occupied.boundingBox(min, max)) return;
+    if (min == Pos{0, 0, 0} && max == Pos{depth - 1, height - 1, width - 1}) return;
+    BasicVoxels cropped{max.z - min.z + 1, max.y - min.y + 1, max.x - min.x + 1, layout};
+    forEachVoxel([&](Pos p, int label) {
+        cropped.set(Pos{p.x - min.x, p.y - min.y, p.z - min.z}, label);
+    });
+    cropped.cropOffset = Pos{cropOffset.x + min.x, cropOffset.y + min.y, cropOffset.z + min.z};
+    cropped.cropSize = uncroppedSize();
+    cropped.removals = removals;
+    *this = std::move(cropped);
+}
+
+template <typename Label>
+bool BasicVoxels<Label>::isInRange(Pos p) const {
+    // negative coordinates wrap around to large unsigned values
+    return (unsigned)p.x < (unsigned)depth
+        && (unsigned)p.y < (unsigned)height
+        && (unsigned)p.z < (unsigned)width;
+}
+
+template <typename Label>
+int BasicVoxels<Label>::stepsToEdge(Pos p, Direction dir) const {
+    switch (dir) {
+        case Direction::XP: return depth - 1 - p.x;
+        case Direction::XN: return p.x;
+        case Direction::YP: return height - 1 - p.y;
+        case Direction::YN: return p.y;
+        case Direction::ZP: return width - 1 - p.z;
+        case Direction::ZN: return p.z;
+    }
+    return 0;
+}
+
+template <typename Label>
+bool BasicVoxels<Label>::existsAt(Pos p) const {
+    return occupied.test(p);
 }
 
-bool Voxels::existsAt(Pos p) const {
-    if (p.x < 0 || p.y < 0 || p.z < 0) return false;
-    if (p.x >= maxX() || p.y >= maxY() || p.z >= maxZ()) return false;
-    int val = (*this)[p];
-    return val != 0;
+template <typename Label>
+bool BasicVoxels<Label>::isUnassigned(Pos p) const {
+    return piecePlanes[1].test(p);
 }
 
-int Voxels::operator[](Pos p) const {
+template <typename Label>
+int BasicVoxels<Label>::operator[](Pos p) const {
     if (!isInRange(p)) {
         return 0;
     }
-    return voxels[p.x * width * height + p.y * width + p.z];
+    return at(indexOf(p));
 }
 
-int &Voxels::operator[](Pos p) {
+template <typename Label>
+typename BasicVoxels<Label>::LabelRef BasicVoxels<Label>::operator[](Pos p) {
     if (!isInRange(p)) {
         std::cerr << "tried to get out of range position " << p << std::endl;
         exit(1);
     }
-    return voxels[p.x * width * height + p.y * width + p.z];
+    return LabelRef{*this, p};
+}
+
+template <typename Label>
+void BasicVoxels<Label>::set(Pos p, int label) {
+    int index = indexOf(p);
+    int oldLabel = at(index);
+    if (label == oldLabel) return;
+    if (openCheckpoints > 0) {
+        journal.push_back({p, static_cast<Label>(oldLabel)});
+    }
+    voxelCount += (label != 0) - (oldLabel != 0);
+    zobristHash ^= zobristKey(p, oldLabel) ^ zobristKey(p, label);
+    if (oldLabel != 0) --labelCounts[oldLabel];
+    if (label != 0) ++labelCounts[label];
+    if (label > maxLabelInUse) {
+        maxLabelInUse = label;
+    }
+    while (maxLabelInUse > 0 && labelCounts[maxLabelInUse] == 0) {
+        --maxLabelInUse;
+    }
+    if (!pieceVoxels.empty()) {
+        if (oldLabel != 0) {
+            std::vector<Pos> &list = pieceVoxels[oldLabel];
+            int slot = pieceSlot(p);
+            list[slot] = list.back();
+            pieceSlot(list[slot]) = slot;
+            list.pop_back();
+        }
+        if (label != 0) {
+            pieceSlot(p) = pieceVoxels[label].size();
+            pieceVoxels[label].push_back(p);
+        }
+    }
+    if (layout == VoxelLayout::Sparse) {
+        int &slot = brickSlots[index >> 6];
+        if (slot < 0 && label != 0) {
+            slot = voxels.size();
+            voxels.resize(voxels.size() + 64);
+        }
+        // writing 0 into an unallocated brick leaves it empty
+        if (slot >= 0) {
+            voxels.set(slot + (index & 63), static_cast<Label>(label));
+        }
+    } else {
+        voxels.set(index, static_cast<Label>(label));
+    }
+    occupied.set(p, label != 0);
+    if (oldLabel != 0) {
+        piecePlanes[oldLabel].set(p, false);
+    }
+    if (label != 0) {
+        if (label >= (int)piecePlanes.size()) {
+            piecePlanes.resize(label + 1, BitGrid{depth, height, width});
+        }
+        piecePlanes[label].set(p, true);
+    }
+    rayTables.markDirty(p);
 }
 
-int Voxels::numNeighboursAt(Pos p) const {
-    int num = 0;
-    if (existsAt(p.nextInDirection(Direction::XP))) ++num;
-    if (existsAt(p.nextInDirection(Direction::XN))) ++num;
-    if (existsAt(p.nextInDirection(Direction::YP))) ++num;
-    if (existsAt(p.nextInDirection(Direction::YN))) ++num;
-    if (existsAt(p.nextInDirection(Direction::ZP))) ++num;
-    if (existsAt(p.nextInDirection(Direction::ZN))) ++num;
-    return num;
+template <typename Label>
+uint64_t BasicVoxels<Label>::zobristKey(Pos p, int label) const {
+    if (label == 0) {
+        return 0;
+    }
+    // Instead of a table of random keys, hash the (position, label) pair
+    // with the splitmix64 finaliser. That gives the same keys in every
+    // grid and thread without storing a key per voxel and label.
+    uint64_t key = ((uint64_t)(p.x * height + p.y) * width + p.z) * (maxLabel() + 1) + label;
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111eb;
+    return key ^ (key >> 31);
+}
+
+template <typename Label>
+int BasicVoxels<Label>::neighbourMaskAt(Pos p) const {
+    // the occupancy grid's border covers the neighbours of voxels in range
+    bool inRange = isInRange(p);
+    int mask = 0;
+    for (Direction d : ALL_DIRECTIONS) {
+        Pos q = p.nextInDirection(d);
+        if (inRange ? occupied.get(q) : existsAt(q)) mask |= 1 << d;
+    }
+    return mask;
 }
 
-int Voxels::numExteriorFaces(Pos p) const {
+template <typename Label>
+int BasicVoxels<Label>::numNeighboursAt(Pos p) const {
+    return popcount(neighbourMaskAt(p));
+}
+
+template <typename Label>
+int BasicVoxels<Label>::numExteriorFaces(Pos p) const {
     return 6 - numNeighboursAt(p);
 }
 
-bool Voxels::hasFreePassage(Pos p, Direction dir, bool checkLowerRank) const {
-    int maxI = std::max(maxX(), std::max(maxY(), maxZ()));
-    int pieceIndex = (*this)[p];
-    for (int i = 0; i < maxI; ++i) {
-        p = p.nextInDirection(dir);
-        if (!existsAt(p)) continue;
-        if (!checkLowerRank) return false;
-        // pieces are removed starting with the higher rank, so if the
-        // potentially blocking piece is higher than the current piece (`pieceIndex`),
-        // we can ignore it
-        if (pieceIndex >= (*this)[p]) continue;
-        return false;
-    }
-    return true;
-}
-
-int Voxels::maxPieceIdx() const {
-    int max = 0;
-    for (int x = 0; x < maxX(); ++x) {
-        for (int y = 0; y < maxY(); ++y) {
-            for (int z = 0; z < maxZ(); ++z) {
-                int piece = (*this)[{x, y, z}];
-                if (piece > max) {
-                    max = piece;
-                }
-            }
-        }
+template <typename Label>
+bool BasicVoxels<Label>::hasFreePassage(Pos p, Direction dir, bool checkLowerRank) const {
+    int blockingPiece = rayTables.maxLabelBeyond(*this, p, dir);
+    if (blockingPiece == 0) return true;
+    if (!checkLowerRank) return false;
+    // pieces are removed starting with the higher rank, so if every
+    // potentially blocking piece is lower than the current piece, we can
+    // ignore them
+    return at(indexOf(p)) >= blockingPiece;
+}
+
+template <typename Label>
+int BasicVoxels<Label>::maxPieceIdx() const {
+    return maxLabelInUse;
+}
+
+template <typename Label>
+uint64_t BasicVoxels<Label>::hash() const {
+    return zobristHash;
+}
+
+template <typename Label>
+void BasicVoxels<Label>::buildPieceIndex() const {
+    pieceVoxels.assign(maxLabel() + 1, {});
+    slotBricks.assign((size_t)((depth + 3) >> 2) * ((height + 3) >> 2) * ((width + 3) >> 2), -1);
+    pieceSlots.clear();
+    forEachVoxel([&](Pos p, int label) {
+        pieceSlot(p) = pieceVoxels[label].size();
+        pieceVoxels[label].push_back(p);
+    });
+}
+
+template <typename Label>
+int &BasicVoxels<Label>::pieceSlot(Pos p) const {
+    size_t brick = ((size_t)(p.x >> 2) * ((height + 3) >> 2) + (p.y >> 2)) * ((width + 3) >> 2) + (p.z >> 2);
+    int &start = slotBricks[brick];
+    if (start < 0) {
+        start = pieceSlots.size();
+        pieceSlots.resize(pieceSlots.size() + 64);
     }
-    return max;
+    return pieceSlots[start + ((p.x & 3) << 4) + ((p.y & 3) << 2) + (p.z & 3)];
 }
 
-int Voxels::totalVoxelCount() const {
-    int count = 0;
-    for (int x = 0; x < maxX(); ++x) {
-        for (int y = 0; y < maxY(); ++y) {
-            for (int z = 0; z < maxZ(); ++z) {
-                if (existsAt({x, y, z})) {
-                    ++count;
-                }
-            }
-        }
+template <typename Label>
+const std::vector<Pos> &BasicVoxels<Label>::voxelsOfPiece(int piece) const {
+    if (pieceVoxels.empty()) {
+        buildPieceIndex();
+    }
+    return pieceVoxels[piece];
+}
+
+template <typename Label>
+const BitGrid &BasicVoxels<Label>::occupancy() const {
+    return occupied;
+}
+
+template <typename Label>
+const BitGrid &BasicVoxels<Label>::piecePlane(int piece) const {
+    if (piece < 1 || piece >= (int)piecePlanes.size()) {
+        std::cerr << "No voxels have ever had label " << piece << std::endl;
+        exit(1);
     }
-    return count;
+    return piecePlanes[piece];
 }
 
-std::ostream &operator<<(std::ostream &os, const Voxels &v) {
+template <typename Label>
+int BasicVoxels<Label>::totalVoxelCount() const {
+    return voxelCount;
+}
+
+template <typename Label>
+int BasicVoxels<Label>::unassignedCountInDirection(Pos p, Direction dir) const {
+    return rayTables.unassignedBeyond(*this, p, dir);
+}
+
+template <typename Label>
+int BasicVoxels<Label>::stepsToFarthestVoxel(Pos p, Direction dir) const {
+    return rayTables.stepsToFarthest(*this, p, dir);
+}
+
+template <typename Label>
+std::ostream &operator<<(std::ostream &os, const BasicVoxels<Label> &v) {
     int mx = v.maxX();
     int my = v.maxY();
     int mz = v.maxZ();
@@ -196,7 +1188,8 @@ std::ostream &operator<<(std::ostream &os, const Voxels &v) {
     return os;
 }
 
-double Voxels::accessibilityHeuristic(Pos p, int j) const {
+template <typename Label>
+double BasicVoxels<Label>::accessibilityHeuristic(Pos p, int j) const {
     if (j < 0) {
         std::cerr << "j must not be less than zero" << std::endl;
         exit(1);
@@ -208,47 +1201,87 @@ double Voxels::accessibilityHeuristic(Pos p, int j) const {
     } else {
         auto result = accessibilityHeuristic(p, j - 1);
         auto weight = pow(WEIGHT_FACTOR, (double)j);
+        int mask = neighbourMaskAt(p);
         for (auto d : ALL_DIRECTIONS) {
-            auto posInD = p.nextInDirection(d);
-            if (!existsAt(posInD)) continue;
-            result += weight * accessibilityHeuristic(posInD, j - 1);
+            if (!(mask & (1 << d))) continue;
+            result += weight * accessibilityHeuristic(p.nextInDirection(d), j - 1);
         }
         return result;
     }
 }
 
-void Voxels::invalidateAccessibilityHeuristic() const {
+template <typename Label>
+void BasicVoxels<Label>::invalidateAccessibilityHeuristic() const {
     accessibilityCache = {};
 }
 
-Direction movableDirection(const Voxels &v, int piece) {
+template <typename Label>
+size_t BasicVoxels<Label>::checkpoint() {
+    ++openCheckpoints;
+    return journal.size();
+}
+
+template <typename Label>
+void BasicVoxels<Label>::rollback(size_t checkpoint) {
+    if (openCheckpoints == 0 || checkpoint > journal.size()) {
+        std::cerr << "rollback without a matching checkpoint" << std::endl;
+        exit(1);
+    }
+    // undo in reverse order without journaling the undo itself; going
+    // through set() keeps the bit grids, piece index and ray tables in sync
+    int open = openCheckpoints;
+    openCheckpoints = 0;
+    while (journal.size() > checkpoint) {
+        JournalEntry entry = journal.back();
+        journal.pop_back();
+        set(entry.pos, entry.oldLabel);
+    }
+    openCheckpoints = open - 1;
+    invalidateAccessibilityHeuristic();
+}
+
+template <typename Label>
+void BasicVoxels<Label>::commit(size_t checkpoint) {
+    if (openCheckpoints == 0 || checkpoint > journal.size()) {
+        std::cerr << "commit without a matching checkpoint" << std::endl;
+        exit(1);
+    }
+    // an outer checkpoint may still roll these writes back
+    if (--openCheckpoints == 0) {
+        journal.clear();
+    }
+}
+
+template <typename Label>
+Direction movableDirection(const BasicVoxels<Label> &v, int piece) {
     if (piece == 0) {
         std::cerr << "Piece 0 is invalid" << std::endl;
         exit(1);
     }
+    // a piece is blocked in a direction if sweeping it that way runs into
+    // a piece with a higher label, which has to be removed first
+    BitGrid higherPieces{v.maxX(), v.maxY(), v.maxZ()};
+    for (int label = piece + 1; label <= v.maxPieceIdx(); ++label) {
+        higherPieces |= v.piecePlane(label);
+    }
     bool isXPBlocked = false;
     bool isXNBlocked = false;
     bool isYPBlocked = false;
     bool isYNBlocked = false;
     bool isZPBlocked = false;
     bool isZNBlocked = false;
-    for (int x = 0; x < v.maxX(); ++x) {
-        for (int y = 0; y < v.maxY(); ++y) {
-            for (int z = 0; z < v.maxZ(); ++z) {
-                Pos p = {x, y, z};
-                if (v[p] != piece) continue;
-                for (Direction d : ALL_DIRECTIONS) {
-                    if (!v.hasFreePassage(p, d, true)) {
-                        //std::cerr << "Piece at pos " << p << " can't move in direction " << d << std::endl;
-                        switch (d) {
-                            case Direction::XP: isXPBlocked = true; break;
-                            case Direction::XN: isXNBlocked = true; break;
-                            case Direction::YP: isYPBlocked = true; break;
-                            case Direction::YN: isYNBlocked = true; break;
-                            case Direction::ZP: isZPBlocked = true; break;
-                            case Direction::ZN: isZNBlocked = true; break;
-                        }
-                    }
+    if (piece < v.maxPieceIdx()) {
+        const BitGrid &plane = v.piecePlane(piece);
+        for (Direction d : ALL_DIRECTIONS) {
+            if (plane.swept(d).intersects(higherPieces)) {
+                //std::cerr << "Piece " << piece << " can't move in direction " << d << std::endl;
+                switch (d) {
+                    case Direction::XP: isXPBlocked = true; break;
+                    case Direction::XN: isXNBlocked = true; break;
+                    case Direction::YP: isYPBlocked = true; break;
+                    case Direction::YN: isYNBlocked = true; break;
+                    case Direction::ZP: isZPBlocked = true; break;
+                    case Direction::ZN: isZNBlocked = true; break;
                 }
             }
         }
@@ -263,6 +1296,26 @@ Direction movableDirection(const Voxels &v, int piece) {
     return Direction::ZN;
 }
 
-VoxelPiece Voxels::propertiesForPiece(int piece) const {
+template <typename Label>
+const std::vector<PieceRemoval> &BasicVoxels<Label>::removalOrder() const {
+    return removals;
+}
+
+template <typename Label>
+void BasicVoxels<Label>::setRemovalOrder(std::vector<PieceRemoval> order) {
+    removals = std::move(order);
+}
+
+template <typename Label>
+VoxelPiece BasicVoxels<Label>::propertiesForPiece(int piece) const {
+    for (size_t step = 0; step < removals.size(); ++step) {
+        if (removals[step].piece == piece) {
+            return VoxelPiece{piece, removals[step].dir, (int)step};
+        }
+    }
     return VoxelPiece{piece, maxPieceIdx(), movableDirection(*this, piece)};
 }
+
+template class BasicVoxels<uint8_t>;
+template std::ostream &operator<<(std::ostream &os, const BasicVoxels<uint8_t> &v);
+template Direction movableDirection(const BasicVoxels<uint8_t> &v, int piece);
@@ -1,47 +1,306 @@
 #ifndef HEADER_VOXELS
 #define HEADER_VOXELS
 
+#include "BitGrid.h"
+#include "LabelStorage.h"
+#include "RayTables.h"
 #include "VoxelPiece.h"
 
+#include <array>
+#include <cstdint>
+#include <iosfwd>
 #include <vector>
 #include <string>
 
 struct Pos;
 
-class Voxels {
+template <typename Label>
+class BasicVoxels;
+
+template <typename Label>
+std::ostream &operator<<(std::ostream &os, const BasicVoxels<Label> &v);
+
+// How labels are laid out in memory. Linear stores one z row after another,
+// so a step in x jumps over a whole plane. Bricked stores 4x4x4 bricks of 64
+// consecutive voxels, so most neighbours share a cache line with the voxel.
+// Sparse addresses voxels like Bricked, but only allocates bricks that
+// contain at least one voxel, which suits thin shells in large grids.
+enum class VoxelLayout {
+    Linear,
+    Bricked,
+    Sparse,
+};
+
+// How a label volume stores its voxels. Raw is the grid's storage as is,
+// which is mapped and used without decoding. Occupancy packs one bit per
+// voxel, for shapes without pieces, and RunLength stores runs of equal
+// labels. Both of those are far smaller and are decoded into memory on load.
+enum class VolumeEncoding {
+    Raw,
+    Occupancy,
+    RunLength,
+};
+
+// A piece of a finished puzzle and the direction it slides out in
+struct PieceRemoval {
+    int piece;
+    Direction dir;
+};
+
+// `Label` is the storage type of a single voxel: 0 is empty, 1 is material
+// that hasn't been assigned to a piece yet, and every piece uses its own
+// label above that. It only needs to be wide enough for the number of pieces.
+// Only 8-bit labels are instantiated, so a grid holds at most 254 pieces.
+
+template <typename Label = uint8_t>
+class BasicVoxels {
     int width = 0;
     int height = 0;
-    std::vector<int> voxels;
+    int depth = 0;
+    VoxelLayout layout = VoxelLayout::Linear;
+    // position of {0, 0, 0} in the shape the grid was cropped from, and that
+    // shape's size along x, y and z, or all zeros if it wasn't cropped
+    Pos cropOffset{0, 0, 0};
+    Pos cropSize{0, 0, 0};
+    // Labels are stored with a one voxel empty border on every side, so
+    // the neighbours of any voxel in range can be read without bounds
+    // checks. `origin` is the index of {0, 0, 0}.
+    LabelStorage<Label> voxels;
+    int origin = 0;
+    int strideX = 0;
+    int strideY = 0;
+    // number of bricks along y and z, only used by the bricked layouts
+    int bricksY = 0;
+    int bricksZ = 0;
+    // sparse layout: where each brick starts in `voxels`, or -1 if the
+    // brick is empty and hasn't been allocated
+    std::vector<int> brickSlots;
+    int voxelCount = 0;
+    // Zobrist hash of every (position, label) pair with a non-zero label
+    uint64_t zobristHash = 0;
+    // number of voxels with each label, and the highest label in use
+    std::vector<int> labelCounts;
+    int maxLabelInUse = 0;
+    // Voxels of each piece, built on the first per-piece query and then
+    // kept up to date by every write. `pieceSlots` holds the position of
+    // each voxel in its piece's list, so it can be swap-removed. Slots are
+    // stored in 4x4x4 bricks that are allocated when one of their voxels is
+    // first written, and `slotBricks` holds where each brick starts (or -1),
+    // so the index grows with the occupied bricks rather than the grid.
+    mutable std::vector<std::vector<Pos>> pieceVoxels;
+    mutable std::vector<int> slotBricks;
+    mutable std::vector<int> pieceSlots;
+    // index offset of a step in each direction: a plain stride for the linear
+    // layout, or the step within a brick for the bricked layout
+    std::array<int, 6> offsets{};
+    // bricked layout: offset of a step that leaves the current brick
+    std::array<int, 6> brickExits{};
+    static constexpr int brickShifts[6] = {4, 4, 2, 2, 0, 0};
+    static constexpr int brickFaces[6] = {3, 0, 3, 0, 3, 0};
+    // occupancy (label != 0) bits, and one plane of bits per label so that
+    // whole pieces can be moved and intersected a word at a time. Plane 1
+    // holds the unassigned voxels and plane 0 is never allocated. Both are
+    // kept in sync with `voxels` by every write.
+    BitGrid occupied;
+    std::vector<BitGrid> piecePlanes;
+    mutable RayTables<Label> rayTables;
     mutable std::vector<std::vector<double>> accessibilityCache;
+    // pieces in the order they come out of the finished puzzle
+    std::vector<PieceRemoval> removals;
+
+    struct JournalEntry {
+        Pos pos;
+        Label oldLabel;
+    };
+    // previous labels of every voxel written since the outermost open checkpoint
+    std::vector<JournalEntry> journal;
+    int openCheckpoints = 0;
+
+    BasicVoxels(int width, int height, int depth, VoxelLayout layout, LabelStorage<Label> storage);
+
+    // rebuilds the counts, hash and bit grids from labels that were
+    // loaded without going through set(), reading them in storage order
+    void allocateStorage(size_t size);
+    void scanStorage();
+    void set(Pos p, int label);
+    uint64_t zobristKey(Pos p, int label) const;
+    void buildPieceIndex() const;
+    int &pieceSlot(Pos p) const;
 
 public:
-    Voxels(int width, int height, int depth);
+    // Returned by the non-const operator[] so that writes can keep the
+    // bit grids up to date
+    class LabelRef {
+        BasicVoxels &voxels;
+        Pos pos;
+
+    public:
+        LabelRef(BasicVoxels &voxels, Pos pos);
+        operator int() const;
+        LabelRef &operator=(int label);
+        // copies the label, so that `a[p] = b[q]` works
+        LabelRef &operator=(const LabelRef &other);
+    };
 
-    static Voxels readFile(const std::string &filename);
+    BasicVoxels(int width, int height, int depth, VoxelLayout layout = VoxelLayout::Linear);
+
+    // Copies share labels and bit grids chunk by chunk until one of them
+    // writes to a chunk, so a copy costs a pointer per chunk. Caches that
+    // are built on first use aren't copied, the copy rebuilds them if needed.
+    BasicVoxels(const BasicVoxels &other);
+    BasicVoxels(BasicVoxels &&other) = default;
+    BasicVoxels &operator=(const BasicVoxels &other);
+    BasicVoxels &operator=(BasicVoxels &&other) = default;
+
+    static int maxLabel();
+
+    // Reads a text shape, cropped to the bounding box of its voxels so that
+    // empty margins in the file cost nothing. A text shape is its width,
+    // height and depth, then a '.' or 'x' for each voxel. A voxel can be
+    // preceded by a count to repeat it, e.g. "12x3." for 12 'x's and 3 '.'s.
+    static BasicVoxels readFile(const std::string &filename, VoxelLayout layout = VoxelLayout::Linear);
+    // Writes the grid as a text shape, with counts for runs of voxels if
+    // runLength is set. Text shapes have no pieces, so every non-empty voxel
+    // is written as 'x'.
+    void writeFile(const std::string &filename, bool runLength = false) const;
+
+    // Reads the first model of a MagicaVoxel .vox file, streaming its voxels
+    // in blocks. Each voxel's label is its palette index, so parts painted
+    // in different colours come in with different labels. Like text shapes,
+    // models are cropped to the bounding box of their voxels.
+    static BasicVoxels readVox(const std::string &filename, VoxelLayout layout = VoxelLayout::Linear);
+    // Writes the grid as a MagicaVoxel model, with label n as palette index
+    // n in the colour the viewer gives piece n. Models are at most 256
+    // voxels along each axis.
+    void writeVox(const std::string &filename) const;
+
+    // A label volume is the grid's storage written out as is, so it can be
+    // mapped instead of read and decoded. Labels are paged in from the file,
+    // and a chunk of labels is copied into memory when it's first written
+    // to, so the file is never changed. Mapping only saves the copy: every
+    // label is read once on load, for the checksum and the occupancy grid,
+    // and the grid's other structures live in memory. The occupancy grid and
+    // each piece's plane take a bit per voxel, the ray tables 8 bytes per
+    // voxel along each axis whose rows are queried, and the piece index about
+    // 16 bytes per occupied voxel, so a grid has to fit in RAM at a few bytes
+    // per voxel either way. Sparse grids are written with the bricked layout.
+    // Volumes in the other encodings are decoded instead. The data of every
+    // volume is checked against the checksum in its header when it's loaded.
+    // The removal order is stored after the data, so a finished puzzle can
+    // be opened without generating it again.
+    static BasicVoxels mapVolume(const std::string &filename);
+    void writeVolume(const std::string &filename, VolumeEncoding encoding = VolumeEncoding::Raw) const;
+    bool isMapped() const;
 
     int maxX() const;
     int maxY() const;
     int maxZ() const;
+    VoxelLayout storageLayout() const;
+    // Position of {0, 0, 0} in the original shape, if the grid was cropped
+    Pos offset() const;
+    // Size of the original shape along x, y and z, which is the grid's own
+    // size if it wasn't cropped. Writers put the margins back, so a cropped
+    // shape is written out at its original size and position.
+    Pos uncroppedSize() const;
+    // Shrinks the grid to the bounding box of its voxels, adding the
+    // removed margin to offset(). There must be no open checkpoints.
+    void cropToContents();
 
     bool isInRange(Pos p) const;
     bool existsAt(Pos p) const;
+    bool isUnassigned(Pos p) const;
 
     int operator[](Pos p) const;
-    int &operator[](Pos p);
+    LabelRef operator[](Pos p);
+
+    // Unchecked access for hot loops: p must be in range or a direct
+    // neighbour of a voxel in range, and walks along a ray must not take
+    // more than stepsToEdge() steps.
+    int indexOf(Pos p) const {
+        if (layout == VoxelLayout::Linear) {
+            return origin + p.x * strideX + p.y * strideY + p.z;
+        }
+        int x = p.x + 1, y = p.y + 1, z = p.z + 1;
+        return (((x >> 2) * bricksY + (y >> 2)) * bricksZ + (z >> 2)) * 64
+            + ((x & 3) << 4) + ((y & 3) << 2) + (z & 3);
+    }
+    int step(int index, Direction dir) const {
+        if (layout == VoxelLayout::Linear) {
+            return index + offsets[dir];
+        }
+        int inBrick = (index >> brickShifts[dir]) & 3;
+        return index + (inBrick == brickFaces[dir] ? brickExits[dir] : offsets[dir]);
+    }
+    int at(int index) const {
+        if (layout != VoxelLayout::Sparse) {
+            return voxels[index];
+        }
+        int slot = brickSlots[index >> 6];
+        return slot < 0 ? 0 : voxels[slot + (index & 63)];
+    }
+    int stepsToEdge(Pos p, Direction dir) const;
+
+    // Calls f(pos, label) for every non-empty voxel in x, y, z order,
+    // skipping empty space a word of the occupancy grid at a time
+    template <typename F>
+    void forEachVoxel(F f) const {
+        occupied.forEach([&](Pos p) {
+            f(p, at(indexOf(p)));
+        });
+    }
+
     void print(bool detailed = false) const;
 
+    // Bit `1 << dir` is set if there's a voxel next to p in direction dir
+    int neighbourMaskAt(Pos p) const;
     int numNeighboursAt(Pos p) const;
     int numExteriorFaces(Pos p) const;
     bool hasFreePassage(Pos p, Direction dir, bool checkLowerRank) const;
     int maxPieceIdx() const;
+    // Hash of the labels of all voxels, kept up to date by every write.
+    // Equal grids hash equally regardless of their storage layout.
+    uint64_t hash() const;
+    // Voxels with the given label, in no particular order. Label 1 gives
+    // the voxels that are still unassigned, so phases that only care about
+    // those cost O(remaining voxels) instead of a scan of the grid.
+    const std::vector<Pos> &voxelsOfPiece(int piece) const;
+    // Bits of every non-empty voxel
+    const BitGrid &occupancy() const;
+    // Bits of every voxel with the given label, for piece >= 1
+    const BitGrid &piecePlane(int piece) const;
     int totalVoxelCount() const;
+    int unassignedCountInDirection(Pos p, Direction dir) const;
+    // Number of steps from p to the farthest voxel in direction dir, or 0
+    // if there are no voxels in that direction
+    int stepsToFarthestVoxel(Pos p, Direction dir) const;
 
     double accessibilityHeuristic(Pos p, int j) const;
     void invalidateAccessibilityHeuristic() const;
 
+    // Pieces in the order they're taken out of the finished puzzle, with the
+    // direction each one moves in, as recorded by the generator. Empty until
+    // the pieces have been cut. The viewer animates pieces in this order.
+    const std::vector<PieceRemoval> &removalOrder() const;
+    void setRemovalOrder(std::vector<PieceRemoval> order);
+
     VoxelPiece propertiesForPiece(int piece) const;
 
-    friend std::ostream &operator<<(std::ostream &os, const Voxels &v);
+    // Writes made after checkpoint() are journaled, so that rollback() can
+    // undo them in O(changed voxels) instead of restoring a copy of the
+    // grid. Checkpoints nest, and each one must be closed by either
+    // rollback() or commit() with the value checkpoint() returned.
+    size_t checkpoint();
+    void rollback(size_t checkpoint);
+    void commit(size_t checkpoint);
+
+    friend std::ostream &operator<< <>(std::ostream &os, const BasicVoxels &v);
 };
 
+// First direction in which the piece can slide out without running into a
+// piece with a higher label
+template <typename Label>
+Direction movableDirection(const BasicVoxels<Label> &v, int piece);
+
+using Voxels = BasicVoxels<uint8_t>;
+
 #endif // HEADER_VOXELS
@@ -0,0 +1,44 @@
+#include "VoxelsView.h"
+
+#include <algorithm>
+
+template <typename Label>
+BasicVoxelsView<Label>::BasicVoxelsView(Pos minCorner, Pos maxCorner)
+    : minCorner{minCorner}, maxCorner{maxCorner} {}
+
+template <typename Label>
+BasicVoxelsView<Label> BasicVoxelsView<Label>::aroundPiece(const BasicVoxels<Label> &voxels, int piece, int margin) {
+    const std::vector<Pos> &pieceVoxels = voxels.voxelsOfPiece(piece);
+    if (pieceVoxels.empty()) {
+        return BasicVoxelsView{Pos{0, 0, 0}, Pos{0, 0, 0}};
+    }
+    Pos min = pieceVoxels[0];
+    Pos max = pieceVoxels[0];
+    for (Pos p : pieceVoxels) {
+        min = Pos{std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z)};
+        max = Pos{std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z)};
+    }
+    return BasicVoxelsView{
+        Pos{std::max(0, min.x - margin), std::max(0, min.y - margin), std::max(0, min.z - margin)},
+        Pos{std::min(voxels.maxX(), max.x + margin + 1), std::min(voxels.maxY(), max.y + margin + 1),
+            std::min(voxels.maxZ(), max.z + margin + 1)}};
+}
+
+template <typename Label>
+Pos BasicVoxelsView<Label>::min() const {
+    return minCorner;
+}
+
+template <typename Label>
+Pos BasicVoxelsView<Label>::max() const {
+    return maxCorner;
+}
+
+template <typename Label>
+bool BasicVoxelsView<Label>::isEmpty() const {
+    return minCorner.x >= maxCorner.x
+        || minCorner.y >= maxCorner.y
+        || minCorner.z >= maxCorner.z;
+}
+
+template class BasicVoxelsView<uint8_t>;
@@ -0,0 +1,31 @@
+#ifndef HEADER_VOXELS_VIEW
+#define HEADER_VOXELS_VIEW
+
+#include "Pos.h"
+#include "Voxels.h"
+
+#include <cstdint>
+
+// A box of a grid, e.g. around one piece, found without copying or scanning
+// any voxels outside it. It doesn't follow later writes to the grid.
+template <typename Label = uint8_t>
+class BasicVoxelsView {
+    // inclusive lower and exclusive upper corner of the box
+    Pos minCorner;
+    Pos maxCorner;
+
+    BasicVoxelsView(Pos minCorner, Pos maxCorner);
+
+public:
+    // The bounding box of a piece grown by margin on every side (clipped to
+    // the grid), e.g. a margin of 1 also covers the piece's neighbours
+    static BasicVoxelsView aroundPiece(const BasicVoxels<Label> &voxels, int piece, int margin = 0);
+
+    Pos min() const;
+    Pos max() const;
+    bool isEmpty() const;
+};
+
+using VoxelsView = BasicVoxelsView<uint8_t>;
+
+#endif // HEADER_VOXELS_VIEW
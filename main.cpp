@@ -1,10 +1,17 @@
+#include "BitGrid.h"
 #include "Direction.h"
+#include "FixedVoxels.h"
+#include "Mesh.h"
 #include "Pos.h"
 #include "Voxels.h"
+#include "VoxelSet.h"
 #include "UI.h"
 #include "utils.h"
 
 #include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
 #include <vector>
 #include <deque>
 #include <unordered_set>
@@ -29,32 +36,33 @@ std::vector<SeedVoxel> initialSeedCandidates(const Voxels &v, bool debug) {
     int skippedDueToWrongFaceCount = 0;
     int skippedDueToNonFreePassage = 0;
     const Direction removalDir = Direction::YP;
-    for (int x = 0; x < v.maxX(); ++x) {
-        for (int y = 0; y < v.maxX(); ++y) {
-            for (int z = 0; z < v.maxX(); ++z) {
-                auto p = Pos(x, y, z);
-                if (!v.existsAt(p)) {
-                    continue;
-                }
-                if (v.numExteriorFaces(p) != 2) {
-                    ++skippedDueToWrongFaceCount;
-                    continue;
-                }
-                if (!v.hasFreePassage(p, removalDir, false)) {
-                    ++skippedDueToNonFreePassage;
-                    continue;
-                }
-                Direction normalDir = removalDir;
-                if (!v.existsAt(p.nextInDirection(Direction::XP))) normalDir = Direction::XP;
-                if (!v.existsAt(p.nextInDirection(Direction::XN))) normalDir = Direction::XN;
-                if (!v.existsAt(p.nextInDirection(Direction::YN))) normalDir = Direction::YN;
-                if (!v.existsAt(p.nextInDirection(Direction::ZP))) normalDir = Direction::ZP;
-                if (!v.existsAt(p.nextInDirection(Direction::ZN))) normalDir = Direction::ZN;
-                if (normalDir == removalDir) continue;
-                results.push_back(SeedVoxel{p, removalDir, normalDir});
-            }
+    // only unassigned voxels can start a piece, so walk the list of them
+    // instead of scanning the whole grid
+    for (Pos p : v.voxelsOfPiece(1)) {
+        int neighbours = v.neighbourMaskAt(p);
+        // i.e. two exterior faces
+        if (popcount(neighbours) != 4) {
+            ++skippedDueToWrongFaceCount;
+            continue;
         }
+        if (!v.hasFreePassage(p, removalDir, false)) {
+            ++skippedDueToNonFreePassage;
+            continue;
+        }
+        Direction normalDir = removalDir;
+        if (!(neighbours & (1 << Direction::XP))) normalDir = Direction::XP;
+        if (!(neighbours & (1 << Direction::XN))) normalDir = Direction::XN;
+        if (!(neighbours & (1 << Direction::YN))) normalDir = Direction::YN;
+        if (!(neighbours & (1 << Direction::ZP))) normalDir = Direction::ZP;
+        if (!(neighbours & (1 << Direction::ZN))) normalDir = Direction::ZN;
+        if (normalDir == removalDir) continue;
+        results.push_back(SeedVoxel{p, removalDir, normalDir});
     }
+    // the list isn't in any particular order, so put the seeds back into
+    // grid order to pick the same one a scan would
+    std::sort(results.begin(), results.end(), [](const SeedVoxel &s1, const SeedVoxel &s2) {
+        return s1.pos < s2.pos;
+    });
     if (debug) {
         std::cout << "Found " << results.size() << " initial seed candidates" <<
             " (rejected " << skippedDueToWrongFaceCount <<
@@ -64,38 +72,36 @@ std::vector<SeedVoxel> initialSeedCandidates(const Voxels &v, bool debug) {
 }
 
 int costOfSubsequentSeed(const Voxels &v, const SeedVoxel &seed) {
-    int cost = 0;
-    Pos next = seed.pos.nextInDirection(seed.removalDir);
-    while (v.isInRange(next)) {
-        if (v[next] == 1) ++cost;
-        next = next.nextInDirection(seed.removalDir);
-    }
-    return cost;
+    return v.unassignedCountInDirection(seed.pos, seed.removalDir);
 }
 
 std::vector<SeedVoxel> subsequentSeedCandidates(const Voxels &v, bool debug, int pieceNum, Direction previousRemovalDir) {
     std::vector<SeedVoxel> results;
-    for (int x = 0; x < v.maxX(); ++x) {
-        for (int y = 0; y < v.maxX(); ++y) {
-            for (int z = 0; z < v.maxX(); ++z) {
-                auto p = Pos(x, y, z);
-                if (!v.existsAt(p)) {
-                    continue;
-                }
-                Direction removalDir = previousRemovalDir;
-                for (Direction d : ALL_DIRECTIONS) {
-                    Pos next = p.nextInDirection(d);
-                    // part of previous piece
-                    if (v.existsAt(next) && v[next] == pieceNum && d.isPerpendicular(previousRemovalDir)) {
-                        removalDir = d;
-                    }
-                }
-                if (removalDir == previousRemovalDir) continue;
-                SeedVoxel seed{p, removalDir};
-                std::cout << "cost: " << costOfSubsequentSeed(v, seed) << std::endl;
-                results.push_back(seed);
+    // seeds touch the previous piece from the side, so only the neighbours
+    // of its voxels are searched, in grid order
+    std::vector<Pos> candidates;
+    for (Pos q : v.voxelsOfPiece(pieceNum)) {
+        for (Direction d : ALL_DIRECTIONS) {
+            if (!d.isPerpendicular(previousRemovalDir)) continue;
+            Pos p = q.nextInDirection(d);
+            if (v.existsAt(p)) candidates.push_back(p);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    for (Pos p : candidates) {
+        Direction removalDir = previousRemovalDir;
+        for (Direction d : ALL_DIRECTIONS) {
+            Pos next = p.nextInDirection(d);
+            // part of previous piece
+            if (v.existsAt(next) && v[next] == pieceNum && d.isPerpendicular(previousRemovalDir)) {
+                removalDir = d;
             }
         }
+        if (removalDir == previousRemovalDir) continue;
+        SeedVoxel seed{p, removalDir};
+        std::cout << "cost: " << costOfSubsequentSeed(v, seed) << std::endl;
+        results.push_back(seed);
     }
     if (debug) {
         std::cout << "Found " << results.size() << " subsequent seed candidates" << std::endl;
@@ -135,30 +141,29 @@ struct OrientedPair {
 };
 
 std::vector<OrientedPair> breadthFirstPairSearch(
-    const Voxels &v, SeedVoxel seed, const std::vector<Pos> &anchors
+    const Voxels &v, SeedVoxel seed, const VoxelSet &anchors
 ) {
     std::vector<OrientedPair> results;
-    std::vector<Pos> done;
+    // everything that has ever been queued, whether it's been visited or not
+    VoxelSet seen{v};
+    seen.insert(seed.pos);
     std::deque<Pos> queue{seed.pos};
     while (!queue.empty() && results.size() < 50) {
         auto pos = queue.front();
         queue.pop_front();
 
         auto otherPosInPair = pos.nextInDirection(seed.normalDir.opposite());
-        if (v.existsAt(pos) && v.existsAt(otherPosInPair) && !contains(anchors, otherPosInPair)) {
-            if (v[pos] == 1 && v[otherPosInPair] == 1) {
+        if (v.existsAt(pos) && v.existsAt(otherPosInPair) && !anchors.contains(otherPosInPair)) {
+            if (v.isUnassigned(pos) && v.isUnassigned(otherPosInPair)) {
                 OrientedPair result{pos, otherPosInPair};
                 results.push_back(result);
             }
         }
 
-        done.push_back(pos);
         for (Direction dir : ALL_DIRECTIONS) {
             auto nextPos = pos.nextInDirection(dir);
-            if (nextPos == seed.pos) continue;
             if (!v.existsAt(nextPos)) continue;
-            if (std::find(done.begin(), done.end(), nextPos) != done.end()) continue;
-            if (std::find(queue.begin(), queue.end(), nextPos) != queue.end()) continue;
+            if (!seen.insert(nextPos)) continue;
             queue.push_back(nextPos);
         }
     }
@@ -166,7 +171,7 @@ std::vector<OrientedPair> breadthFirstPairSearch(
 }
 
 std::vector<OrientedPair> inaccessiblePairs(
-    const Voxels &v, SeedVoxel seed, const std::vector<Pos> &anchors
+    const Voxels &v, SeedVoxel seed, const VoxelSet &anchors
 ) {
     std::vector<OrientedPair> candidates = breadthFirstPairSearch(v, seed, anchors);
     std::sort(candidates.begin(), candidates.end(),
@@ -215,16 +220,101 @@ Voxels solvedThreeCube() {
     return result;
 }
 
+// A mesh can be given a resolution after a colon, e.g. "teapot.obj:64".
+// Returns false if arg isn't a mesh.
+bool parseMeshArgument(const std::string &arg, std::string &filename, int &resolution) {
+    filename = arg;
+    resolution = 32;
+    size_t colon = arg.rfind(':');
+    if (colon != std::string::npos && colon + 1 < arg.size()
+        && arg.find_first_not_of("0123456789", colon + 1) == std::string::npos) {
+        filename = arg.substr(0, colon);
+        resolution = std::stoi(arg.substr(colon + 1));
+    }
+    return hasExtension(filename, ".stl") || hasExtension(filename, ".obj");
+}
+
+// True if the grid has already been cut into pieces, e.g. a result file.
+// Files without a removal order count if every voxel is in a piece and the
+// pieces come apart in label order.
+bool isFinishedPuzzle(const Voxels &v) {
+    if (!v.removalOrder().empty()) return true;
+    if (v.maxPieceIdx() < 2 || !v.voxelsOfPiece(1).empty()) return false;
+    BitGrid higherPieces{v.maxX(), v.maxY(), v.maxZ()};
+    for (int piece = v.maxPieceIdx(); piece >= 2; --piece) {
+        const BitGrid &plane = v.piecePlane(piece);
+        bool isFree = false;
+        for (Direction d : ALL_DIRECTIONS) {
+            if (!plane.swept(d).intersects(higherPieces)) {
+                isFree = true;
+                break;
+            }
+        }
+        if (!isFree) return false;
+        higherPieces |= plane;
+    }
+    return true;
+}
+
+// Reads a shape in whichever format its file name says
+Voxels readShape(const std::string &arg) {
+    std::string meshFile;
+    int resolution;
+    if (parseMeshArgument(arg, meshFile, resolution)) {
+        return Mesh::readFile(meshFile).voxelize(resolution);
+    }
+    if (hasExtension(arg, ".vol")) {
+        return Voxels::mapVolume(arg);
+    }
+    if (hasExtension(arg, ".vox")) {
+        return Voxels::readVox(arg);
+    }
+    return Voxels::readFile(arg);
+}
+
 Voxels initialiseVoxels(int argc, char *argv[]) {
     switch (argc) {
         case 1:
             std::cout << "Using default shape" << std::endl;
             return solvedThreeCube();
         case 2:
-            std::cout << "Reading file " << argv[1] << "..." << std::endl;
-            return Voxels::readFile(std::string{argv[1]});
+        case 3: {
+            std::string filename{argv[1]};
+            std::string meshFile;
+            int resolution;
+            bool isMesh = parseMeshArgument(filename, meshFile, resolution);
+            if (isMesh) {
+                std::cout << "Voxelizing mesh " << meshFile << " at resolution " << resolution
+                    << "..." << std::endl;
+            } else if (hasExtension(filename, ".vol")) {
+                std::cout << "Mapping volume " << filename << "..." << std::endl;
+            } else if (hasExtension(filename, ".vox")) {
+                std::cout << "Reading MagicaVoxel model " << filename << "..." << std::endl;
+            } else {
+                std::cout << "Reading file " << filename << "..." << std::endl;
+            }
+            Voxels result = readShape(filename);
+            if (!isMesh && hasExtension(filename, ".vox") && !isFinishedPuzzle(result)) {
+                // pieces are cut from the whole model, whatever its colours
+                for (int label = 2; label <= result.maxPieceIdx(); ++label) {
+                    std::vector<Pos> voxels = result.voxelsOfPiece(label);
+                    for (Pos p : voxels) {
+                        result[p] = 1;
+                    }
+                }
+            }
+            if (!(result.offset() == Pos{0, 0, 0})) {
+                std::cout << "Cropped empty margins, offset " << result.offset() << std::endl;
+            }
+            return result;
+        }
         default:
-            std::cout << "Usage: ./puzzles <shape file>" << std::endl;
+            std::cout << "Usage: ./puzzles <shape file> [result file]" << std::endl;
+            std::cout << "       ./puzzles <mesh file>[:resolution] [result file]" << std::endl;
+            std::cout << "       ./puzzles --benchmark [size]" << std::endl;
+            std::cout << "       ./puzzles --benchmark-load [size]" << std::endl;
+            std::cout << "       ./puzzles --benchmark-mesh [resolution]" << std::endl;
+            std::cout << "       ./puzzles --convert <from file> <to file> [raw|bits|rle]" << std::endl;
             std::cout << "Using default shape" << std::endl;
             return solvedThreeCube();
     }
@@ -232,7 +322,7 @@ Voxels initialiseVoxels(int argc, char *argv[]) {
 
 std::vector<std::vector<Pos>> findPaths(
     Pos from, Pos to, Pos disallowed, Direction disallowedDir, int maxLength,
-    const std::vector<Pos> anchors, const Voxels &v
+    const VoxelSet &anchors, const Voxels &v
 ) {
     // return all shortest paths, not crossing 'disallowed' or any in disallowedDir
     if (from == to) return {{}};
@@ -240,9 +330,9 @@ std::vector<std::vector<Pos>> findPaths(
     std::vector<Pos> steps;
     for (Direction dir : ALL_DIRECTIONS) {
         Pos nextPos = from.nextInDirection(dir);
-        if (v[nextPos] != 1) continue;
+        if (!v.isUnassigned(nextPos)) continue;
         if (nextPos.isInLine(disallowed, disallowedDir.opposite())) continue;
-        if (contains(anchors, nextPos)) continue;
+        if (anchors.contains(nextPos)) continue;
         if (nextPos == to) {
             return {{to}};
         }
@@ -268,19 +358,28 @@ std::vector<std::vector<Pos>> findPaths(
 // Returns false if that isn't possible because we'd have to add an anchor voxel
 bool addUpwardVoxels(
     std::vector<Pos> &path, Direction removalDir,
-    const std::vector<Pos> anchors, const Voxels &v
+    const VoxelSet &anchors, const Voxels &v
 ) {
+    VoxelSet members{v};
+    for (const auto &p : path) {
+        members.insert(p);
+    }
     std::vector<Pos> extraVoxels;
     for (const auto &p : path) {
-        Pos next = p.nextInDirection(removalDir);
-        while (v.isInRange(next)) {
-            if (v[next] == 1 && !contains(path, next) && !contains(extraVoxels, next)) {
-                if (contains(anchors, next)) {
+        if (v.unassignedCountInDirection(p, removalDir) == 0) continue;
+        int steps = v.stepsToFarthestVoxel(p, removalDir);
+        int index = v.indexOf(p);
+        Pos next = p;
+        for (int i = 0; i < steps; ++i) {
+            next = next.nextInDirection(removalDir);
+            index = v.step(index, removalDir);
+            if (v.at(index) == 1 && !members.contains(next)) {
+                if (anchors.contains(next)) {
                     return false;
                 }
+                members.insert(next);
                 extraVoxels.push_back(next);
             }
-            next = next.nextInDirection(removalDir);
         }
     }
     for (const auto &p : extraVoxels) {
@@ -296,7 +395,7 @@ struct PotentialPiece {
 
 std::vector<PotentialPiece> findPotentialPieces(
     Pos from, const std::vector<OrientedPair> &blockingPairs, Direction disallowedDir,
-    const std::vector<Pos> anchors, const Voxels &v
+    const VoxelSet &anchors, const Voxels &v
 ) {
     std::vector<PotentialPiece> shortestPaths;
     int shortestPathLength = 0;
@@ -321,36 +420,36 @@ std::vector<PotentialPiece> findPotentialPieces(
     return shortestPaths;
 }
 
-std::vector<Pos> findAnchors(const SeedVoxel &seed, const Voxels &v) {
-    std::vector<Pos> anchors;
+VoxelSet findAnchors(const SeedVoxel &seed, const Voxels &v) {
+    VoxelSet anchors{v};
     for (Direction dir : ALL_DIRECTIONS) {
         if (dir == seed.normalDir) continue;
         if (dir == seed.removalDir) continue;
-        Pos next = seed.pos.nextInDirection(dir);
-        Pos anchor = next;
-        while (v.isInRange(next)) {
-            if (v.existsAt(next)) {
-                anchor = next;
-            }
-            next = next.nextInDirection(dir);
-        }
-        if (v.existsAt(anchor)) {
-            anchors.push_back(anchor);
+        int steps = v.stepsToFarthestVoxel(seed.pos, dir);
+        if (steps == 0) continue;
+        Pos anchor = seed.pos;
+        for (int i = 0; i < steps; ++i) {
+            anchor = anchor.nextInDirection(dir);
         }
+        anchors.insert(anchor);
     }
     return anchors;
 }
 
-void expandPiece(std::vector<Pos> &piece, std::vector<Pos> anchors, const Voxels &v, const SeedVoxel &seed) {
-    std::vector<Pos> candidateVoxels;
+void expandPiece(std::vector<Pos> &piece, const VoxelSet &anchors, const Voxels &v, const SeedVoxel &seed) {
+    VoxelSet pieceVoxels{v};
+    for (Pos p : piece) {
+        pieceVoxels.insert(p);
+    }
+    VoxelSet candidateVoxels{v};
     for (Pos p : piece) {
         for (Direction dir : ALL_DIRECTIONS) {
             Pos cand = p.nextInDirection(dir);
             if (!v.existsAt(cand)) continue;
-            if (v[cand] != 1) continue;
-            if (contains(piece, cand)) continue;
-            if (contains(candidateVoxels, cand)) continue;
-            if (contains(anchors, cand)) continue;
+            if (!v.isUnassigned(cand)) continue;
+            if (pieceVoxels.contains(cand)) continue;
+            if (candidateVoxels.contains(cand)) continue;
+            if (anchors.contains(cand)) continue;
             bool skip = false;
             for (Pos anchor : anchors) {
                 if (cand.isInLine(anchor, seed.removalDir)) {
@@ -359,7 +458,7 @@ void expandPiece(std::vector<Pos> &piece, std::vector<Pos> anchors, const Voxels
                 }
             }
             if (skip) continue;
-            candidateVoxels.push_back(cand);
+            candidateVoxels.insert(cand);
         }
     }
     
@@ -374,18 +473,18 @@ void expandPiece(std::vector<Pos> &piece, std::vector<Pos> anchors, const Voxels
     std::cout << "Found " << possibleExpansions.size() << " possible expansions" << std::endl;
     
     for (Pos p : possibleExpansions[0]) {
-        if (!contains(piece, p)) {
+        if (pieceVoxels.insert(p)) {
             piece.push_back(p);
         }
     }
 }
 
-void expandPiece(PotentialPiece &piece, std::vector<Pos> anchors, const Voxels &v, const SeedVoxel &seed) {
+void expandPiece(PotentialPiece &piece, VoxelSet anchors, const Voxels &v, const SeedVoxel &seed) {
     Pos additionalAnchor = piece.blockingVoxel;
     while (v.existsAt(additionalAnchor)) {
         additionalAnchor = additionalAnchor.nextInDirection(seed.normalDir);
     }
-    anchors.push_back(additionalAnchor);
+    anchors.insert(additionalAnchor);
     
     expandPiece(piece.voxels, anchors, v, seed);
 }
@@ -393,7 +492,7 @@ void expandPiece(PotentialPiece &piece, std::vector<Pos> anchors, const Voxels &
 Direction constructPiece(Voxels &voxels, int pieceNum, int minSize, Direction previousRemovalDir) {
     std::cout << "Constructing piece " << pieceNum << std::endl;
     SeedVoxel seed = findInitialSeed(voxels, true, pieceNum, previousRemovalDir);
-    std::vector<Pos> anchors = findAnchors(seed, voxels);
+    VoxelSet anchors = findAnchors(seed, voxels);
     std::cout << "seed: " << seed.pos <<
         ", removal direction: " << seed.removalDir <<
         ", normal direction: " << seed.normalDir <<
@@ -408,26 +507,45 @@ Direction constructPiece(Voxels &voxels, int pieceNum, int minSize, Direction pr
         [](const auto &p1, const auto &p2) {
             return p1.voxels.size() < p2.voxels.size();
         });
-    PotentialPiece nextPiece = potentialPieces[0];
-    while ((int)nextPiece.voxels.size() < minSize) {
-        expandPiece(nextPiece, anchors, voxels, seed);
-    }
-    for (const auto &pos : nextPiece.voxels) {
-        voxels[pos] = pieceNum + 1;
+    // Candidates are cut smallest first. Each cut is made after a
+    // checkpoint and rolled back unless the piece can slide out, so a
+    // rejected cut only costs the voxels it wrote. Different candidates
+    // often expand into the same piece, so the hashes of rejected grids
+    // are kept to skip testing those again.
+    std::unordered_set<uint64_t> rejectedCuts;
+    for (size_t i = 0; i < potentialPieces.size(); ++i) {
+        PotentialPiece nextPiece = potentialPieces[i];
+        while ((int)nextPiece.voxels.size() < minSize) {
+            expandPiece(nextPiece, anchors, voxels, seed);
+        }
+        [[maybe_unused]] uint64_t uncutHash = voxels.hash();
+        size_t checkpoint = voxels.checkpoint();
+        for (const auto &pos : nextPiece.voxels) {
+            voxels[pos] = pieceNum + 1;
+        }
+        if (rejectedCuts.count(voxels.hash()) == 0
+            && !voxels.piecePlane(pieceNum + 1).swept(seed.removalDir).intersects(voxels.piecePlane(1))) {
+            voxels.commit(checkpoint);
+            return seed.removalDir;
+        }
+        rejectedCuts.insert(voxels.hash());
+        voxels.rollback(checkpoint);
+        assert(voxels.hash() == uncutHash);
+        std::cout << "Candidate piece " << i << " can't slide out, trying the next one" << std::endl;
     }
-    
-    return seed.removalDir;
+    std::cerr << "None of the " << potentialPieces.size() << " candidate pieces can slide out" << std::endl;
+    exit(1);
 }
 
 std::vector<Pos> expandSubsequentPieceFromSeed(const Voxels &v, const SeedVoxel &seed) {
     std::vector<Pos> piece{seed.pos};
     Pos next = seed.pos.nextInDirection(seed.removalDir);
-    while (v.isInRange(next)) {
-        if (v[next] == 1) {
-            piece.push_back(next);
-        } else {
-            break;
-        }
+    int steps = v.stepsToEdge(seed.pos, seed.removalDir);
+    int index = v.indexOf(seed.pos);
+    for (int i = 0; i < steps; ++i) {
+        index = v.step(index, seed.removalDir);
+        if (v.at(index) != 1) break;
+        piece.push_back(next);
         next = next.nextInDirection(seed.removalDir);
     }
     return piece;
@@ -437,16 +555,23 @@ Direction constructSubsequentPiece(Voxels &voxels, int pieceNum, int minSize, Di
     std::cout << "Constructing piece " << pieceNum << std::endl;
     SeedVoxel seed = findInitialSeed(voxels, true, pieceNum, previousRemovalDir);
     std::vector<Pos> nextPiece = expandSubsequentPieceFromSeed(voxels, seed);
-    std::vector<Pos> anchors;
+    VoxelSet nextPieceVoxels{voxels};
+    for (Pos p : nextPiece) {
+        nextPieceVoxels.insert(p);
+    }
+    VoxelSet anchors{voxels};
     
     // now we need to ensure nextPiece is blocked in all other directions
     for (Direction d : ALL_DIRECTIONS) {
         if (d == seed.removalDir) continue;
+        // moving the piece one step must run into unassigned voxels or the
+        // previous piece, otherwise it could slide out in this direction
+        const BitGrid &unassigned = voxels.piecePlane(1);
+        const BitGrid &previousPiece = voxels.piecePlane(pieceNum);
         bool freePassage = true;
         for (const Pos &p : nextPiece) {
-            Pos next = p.nextInDirection(d);
-            if (!voxels.isInRange(next)) continue;
-            if (voxels[next] == 1 || voxels[next] == pieceNum) {
+            Pos q = p.nextInDirection(d);
+            if (voxels.isInRange(q) && (unassigned.get(q) || previousPiece.get(q))) {
                 freePassage = false;
                 break;
             }
@@ -462,7 +587,7 @@ Direction constructSubsequentPiece(Voxels &voxels, int pieceNum, int minSize, Di
                     return p1.voxels.size() < p2.voxels.size();
                 });
             for (Pos p : potentialPieces[0].voxels) {
-                if (!contains(nextPiece, p)) {
+                if (nextPieceVoxels.insert(p)) {
                     nextPiece.push_back(p);
                 }
             }
@@ -482,27 +607,308 @@ Direction constructSubsequentPiece(Voxels &voxels, int pieceNum, int minSize, Di
 
 void designateFinalPiece(Voxels &v) {
     int max = v.maxPieceIdx();
-    for (int x = 0; x < v.maxX(); ++x) {
-        for (int y = 0; y < v.maxY(); ++y) {
-            for (int z = 0; z < v.maxZ(); ++z) {
-                if (v[{x, y, z}] == 1) {
-                    v[{x, y, z}] = max + 1;
+    // copy the list, since relabelling removes voxels from it
+    std::vector<Pos> remaining = v.voxelsOfPiece(1);
+    for (Pos p : remaining) {
+        v[p] = max + 1;
+    }
+}
+
+Voxels makeBall(int diameter, VoxelLayout layout) {
+    Voxels result{diameter, diameter, diameter, layout};
+    double centre = (diameter - 1) / 2.0;
+    double radius = diameter / 2.0;
+    for (int x = 0; x < diameter; ++x) {
+        for (int y = 0; y < diameter; ++y) {
+            for (int z = 0; z < diameter; ++z) {
+                double dx = x - centre, dy = y - centre, dz = z - centre;
+                if (dx * dx + dy * dy + dz * dz <= radius * radius) {
+                    result[Pos{x, y, z}] = 1;
                 }
             }
         }
     }
+    return result;
+}
+
+template <typename F>
+void timePhase(const char *name, F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "  " << name << ": "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
+        << " ms" << std::endl;
+}
+
+// Times the neighbourhood-heavy parts of piece construction on a solid ball
+// for each storage layout
+void runLayoutBenchmark(int size) {
+    for (VoxelLayout layout : {VoxelLayout::Linear, VoxelLayout::Bricked, VoxelLayout::Sparse}) {
+        switch (layout) {
+            case VoxelLayout::Linear: std::cout << "Linear"; break;
+            case VoxelLayout::Bricked: std::cout << "Bricked"; break;
+            case VoxelLayout::Sparse: std::cout << "Sparse"; break;
+        }
+        std::cout << " layout, " << size << "^3:" << std::endl;
+        Voxels v = makeBall(size, layout);
+        std::vector<SeedVoxel> seeds;
+        timePhase("seed scan", [&] {
+            seeds = initialSeedCandidates(v, false);
+        });
+        if (seeds.empty()) {
+            std::cout << "  no seed candidates" << std::endl;
+            continue;
+        }
+        timePhase("pair search", [&] {
+            for (int i = 0; i < (int)seeds.size() && i < 1000; ++i) {
+                breadthFirstPairSearch(v, seeds[i], findAnchors(seeds[i], v));
+            }
+        });
+        double total = 0;
+        timePhase("accessibility", [&] {
+            for (const SeedVoxel &seed : seeds) {
+                total += v.accessibilityHeuristic(seed.pos, 3);
+            }
+        });
+        // The phases above mostly read the bit grids, so the layouts are
+        // compared on the labels of the ball cut into eight pieces, one per
+        // octant, read through at() and step()
+        int half = size / 2;
+        v.forEachVoxel([&](Pos p, int) {
+            v[p] = 2 + (p.x >= half) + 2 * (p.y >= half) + 4 * (p.z >= half);
+        });
+        long long boundaryFaces = 0;
+        timePhase("neighbour labels", [&] {
+            v.forEachVoxel([&](Pos p, int label) {
+                int index = v.indexOf(p);
+                for (Direction d : ALL_DIRECTIONS) {
+                    int neighbour = v.at(v.step(index, d));
+                    if (neighbour != 0 && neighbour != label) ++boundaryFaces;
+                }
+            });
+        });
+        long long otherLabels = 0;
+        timePhase("ray walks", [&] {
+            int from = std::max(0, half - 16), to = std::min(size, half + 16);
+            for (int x = from; x < to; ++x) {
+                for (int y = from; y < to; ++y) {
+                    for (int z = from; z < to; ++z) {
+                        Pos p{x, y, z};
+                        int start = v.indexOf(p);
+                        int label = v.at(start);
+                        for (Direction d : ALL_DIRECTIONS) {
+                            int index = start;
+                            for (int steps = v.stepsToEdge(p, d); steps > 0; --steps) {
+                                index = v.step(index, d);
+                                int other = v.at(index);
+                                if (other == 0) break;
+                                if (other != label) ++otherLabels;
+                            }
+                        }
+                    }
+                }
+            }
+        });
+        int blocked = 0;
+        timePhase("free passage", [&] {
+            int from = std::max(0, half - 16), to = std::min(size, half + 16);
+            for (int x = from; x < to; ++x) {
+                for (int y = from; y < to; ++y) {
+                    for (int z = from; z < to; ++z) {
+                        for (Direction d : ALL_DIRECTIONS) {
+                            if (!v.hasFreePassage({x, y, z}, d, true)) ++blocked;
+                        }
+                    }
+                }
+            }
+        });
+        std::cout << "  (" << seeds.size() << " seeds, " << total << ", " << boundaryFaces << ", "
+            << otherLabels << ", " << blocked << ")" << std::endl;
+    }
+}
+
+// Writes each piece to its own STL file, named after `filename` with the
+// piece's label before the extension, e.g. "puzzle-2.stl"
+void writePieceStls(const Voxels &v, const std::string &filename) {
+    std::string stem = filename.substr(0, filename.size() - 4);
+    for (int piece = 1; piece <= v.maxPieceIdx(); ++piece) {
+        if (v.voxelsOfPiece(piece).empty()) continue;
+        Mesh mesh = Mesh::ofPiece(v, piece);
+        std::string pieceFile = stem + "-" + std::to_string(piece) + ".stl";
+        mesh.writeStl(pieceFile);
+        int faces = 0;
+        for (Pos p : v.voxelsOfPiece(piece)) {
+            for (Direction d : ALL_DIRECTIONS) {
+                if (v[p.nextInDirection(d)] != piece) ++faces;
+            }
+        }
+        std::cout << "Wrote piece " << piece << " to " << pieceFile << ": " << mesh.numTriangles()
+            << " triangles, " << 2 * faces << " without merging faces" << std::endl;
+    }
+}
+
+// Times reading a text shape of a solid ball, size^3 voxels, from a
+// temporary file, written with and without run lengths
+void runLoadBenchmark(int size) {
+    const char *filename = "load_benchmark.txt";
+    Voxels ball = makeBall(size, VoxelLayout::Linear);
+    for (bool runLength : {false, true}) {
+        ball.writeFile(filename, runLength);
+        std::cout << "Loading a " << size << "^3 shape" << (runLength ? " with run lengths" : "")
+            << ":" << std::endl;
+        int count = 0;
+        timePhase("read", [&] {
+            count = Voxels::readFile(filename).totalVoxelCount();
+        });
+        std::cout << "  (" << count << " voxels)" << std::endl;
+    }
+    std::remove(filename);
+}
+
+// Times voxelizing a closed sphere of about a million triangles
+void runMeshBenchmark(int resolution) {
+    const int rings = 500, segments = 1000;
+    const double pi = 3.141592653589793238;
+    // vertices are computed the same way wherever they're shared, so the
+    // mesh is closed exactly
+    auto vertex = [&](int ring, int segment, float *out) {
+        double theta = pi * ring / rings, phi = 2 * pi * (segment % segments) / segments;
+        out[0] = (float)(std::sin(theta) * std::cos(phi));
+        out[1] = (float)std::cos(theta);
+        out[2] = (float)(std::sin(theta) * std::sin(phi));
+    };
+    std::vector<Triangle> triangles;
+    for (int ring = 0; ring < rings; ++ring) {
+        for (int segment = 0; segment < segments; ++segment) {
+            Triangle first, second;
+            vertex(ring, segment, first.vertices[0]);
+            vertex(ring + 1, segment, first.vertices[1]);
+            vertex(ring + 1, segment + 1, first.vertices[2]);
+            vertex(ring, segment, second.vertices[0]);
+            vertex(ring + 1, segment + 1, second.vertices[1]);
+            vertex(ring, segment + 1, second.vertices[2]);
+            triangles.push_back(first);
+            triangles.push_back(second);
+        }
+    }
+    Mesh mesh{std::move(triangles)};
+    std::cout << "Voxelizing " << mesh.numTriangles() << " triangles at " << resolution << "^3:" << std::endl;
+    int count = 0;
+    timePhase("voxelize", [&] {
+        count = mesh.voxelize(resolution).totalVoxelCount();
+    });
+    std::cout << "  (" << count << " voxels)" << std::endl;
+}
+
+// Converts between text shapes, label volumes and MagicaVoxel models, from
+// a mesh or to STL, picking each format from its file name. Text shapes are written with run
+// lengths for "rle".
+void convertShape(const std::string &from, const std::string &to, const std::string &encodingName) {
+    VolumeEncoding encoding;
+    if (encodingName == "raw") {
+        encoding = VolumeEncoding::Raw;
+    } else if (encodingName == "bits") {
+        encoding = VolumeEncoding::Occupancy;
+    } else if (encodingName == "rle") {
+        encoding = VolumeEncoding::RunLength;
+    } else {
+        std::cerr << "Unknown volume encoding " << encodingName << ", expected raw, bits or rle" << std::endl;
+        exit(1);
+    }
+    Voxels v = readShape(from);
+    if (hasExtension(to, ".vol")) {
+        v.writeVolume(to, encoding);
+    } else if (hasExtension(to, ".vox")) {
+        v.writeVox(to);
+    } else if (hasExtension(to, ".stl")) {
+        // a shape is a single solid, a generated puzzle one per piece
+        if (v.maxPieceIdx() > 1) {
+            writePieceStls(v, to);
+        } else {
+            Mesh::ofPiece(v, 1).writeStl(to);
+        }
+    } else if (encoding == VolumeEncoding::Occupancy) {
+        std::cerr << "Text shapes can't be written as bits, expected raw or rle" << std::endl;
+        exit(1);
+    } else {
+        v.writeFile(to, encoding == VolumeEncoding::RunLength);
+    }
+}
+
+// Puzzles small enough for a FixedVoxels grid are checked again with its
+// bitboards, independently of the generator's own bookkeeping
+void checkSmallPuzzle(const Voxels &v) {
+    using SmallGrid = FixedVoxels<4, 4, 4>;
+    if (v.maxX() > 4 || v.maxY() > 4 || v.maxZ() > 4 || v.maxPieceIdx() > SmallGrid::maxLabel) {
+        return;
+    }
+    if (!SmallGrid{v}.canDisassemble()) {
+        std::cerr << "The generated puzzle can't be taken apart" << std::endl;
+        exit(1);
+    }
 }
 
 int main(int argc, char *argv[]) {
+    if (argc >= 2 && std::string{argv[1]} == "--benchmark") {
+        runLayoutBenchmark(argc >= 3 ? std::stoi(argv[2]) : 256);
+        return 0;
+    }
+    if (argc >= 2 && std::string{argv[1]} == "--benchmark-mesh") {
+        runMeshBenchmark(argc >= 3 ? std::stoi(argv[2]) : 256);
+        return 0;
+    }
+    if (argc >= 2 && std::string{argv[1]} == "--benchmark-load") {
+        runLoadBenchmark(argc >= 3 ? std::stoi(argv[2]) : 512);
+        return 0;
+    }
+    if ((argc == 4 || argc == 5) && std::string{argv[1]} == "--convert") {
+        convertShape(argv[2], argv[3], argc == 5 ? argv[4] : "raw");
+        return 0;
+    }
+    // checked before generating, which can take minutes
+    if (argc == 3 && !hasExtension(argv[2], ".vol") && !hasExtension(argv[2], ".vox")
+        && !hasExtension(argv[2], ".stl")) {
+        std::cerr << "Unknown result file type " << argv[2] << ", expected .vol, .vox or .stl" << std::endl;
+        exit(1);
+    }
     auto voxels = initialiseVoxels(argc, argv);
     std::cout << voxels << std::endl;
-    int pieceSize = voxels.totalVoxelCount() / 4;
-
-    if (argc == 2) {
-        Direction removalDir = constructPiece(voxels, 1, pieceSize, Direction::YP);
-        removalDir = constructSubsequentPiece(voxels, 2, pieceSize, removalDir);
+    if (argc != 1 && isFinishedPuzzle(voxels)) {
+        // a result file already holds the finished puzzle, and pieces
+        // without a recorded removal order fall back to movableDirection
+        std::cout << "Opened finished puzzle with " << voxels.maxPieceIdx() - 1
+            << " pieces, skipping generation" << std::endl;
+    } else {
+        int pieceSize = voxels.totalVoxelCount() / 4;
+
+        std::vector<PieceRemoval> removals;
+        if (argc == 2 || argc == 3) {
+            Direction removalDir = constructPiece(voxels, 1, pieceSize, Direction::YP);
+            removals.push_back({2, removalDir});
+            removalDir = constructSubsequentPiece(voxels, 2, pieceSize, removalDir);
+            removals.push_back({3, removalDir});
+        }
+        designateFinalPiece(voxels);
+        if (!removals.empty()) {
+            int finalPiece = voxels.maxPieceIdx();
+            removals.push_back({finalPiece, movableDirection(voxels, finalPiece)});
+            voxels.setRemovalOrder(std::move(removals));
+        }
+        checkSmallPuzzle(voxels);
+    }
+    if (argc == 3) {
+        if (hasExtension(argv[2], ".stl")) {
+            writePieceStls(voxels, argv[2]);
+        } else {
+            if (hasExtension(argv[2], ".vox")) {
+                voxels.writeVox(argv[2]);
+            } else if (hasExtension(argv[2], ".vol")) {
+                voxels.writeVolume(argv[2], VolumeEncoding::RunLength);
+            }
+            std::cout << "Wrote result to " << argv[2] << std::endl;
+        }
     }
-    designateFinalPiece(voxels);
     initGlfw(voxels);
     return 0;
 }
@@ -1,5 +1,7 @@
 #include "utils.h"
+#include <cctype>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <cmath>
 
@@ -26,3 +28,13 @@ void vec3_rotate_y(vec3 v, float angle) {
     v[1] = result[1];
     v[2] = result[2];
 }
+
+bool hasExtension(const std::string &filename, const char *extension) {
+    size_t length = strlen(extension);
+    if (filename.size() <= length) return false;
+    for (size_t i = 0; i < length; ++i) {
+        char ch = filename[filename.size() - length + i];
+        if (std::tolower((unsigned char)ch) != extension[i]) return false;
+    }
+    return true;
+}
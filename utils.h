@@ -1,7 +1,12 @@
 #ifndef HEADER_UTILS
 #define HEADER_UTILS
 
-#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 typedef float vec3[3];
 
@@ -9,12 +14,35 @@ float deg2rad(float degrees);
 void vec3_rotate_x(vec3 v, float angle);
 void vec3_rotate_y(vec3 v, float angle);
 
-template<typename Collection, typename T>
-bool contains(const Collection &v, T item) {
-    if (std::find(v.begin(), v.end(), item) != v.end()) {
-        return true;
-    }
-    return false;
+// Whether filename ends in extension, e.g. ".stl", ignoring case
+bool hasExtension(const std::string &filename, const char *extension);
+
+inline int popcount(uint64_t word) {
+#ifdef _MSC_VER
+    return (int)__popcnt64(word);
+#else
+    return __builtin_popcountll(word);
+#endif
+}
+
+inline int countTrailingZeros(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return (int)index;
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+inline int countLeadingZeros(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, word);
+    return 63 - (int)index;
+#else
+    return __builtin_clzll(word);
+#endif
 }
 
 #endif // HEADER_UTILS